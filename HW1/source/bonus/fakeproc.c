@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Writes a fake /proc tree for 'pstree --proc=DIR', so that pstree can be
+// measured on hosts much bigger than the one it runs on:
+//     fakeproc DIR PROCESSES [THREADS [DEPTH [FANOUT]]]
+// Processes form a tree of at most DEPTH levels under pid 1 where each node
+// has up to FANOUT children; every process gets THREADS extra threads.
+
+#define MAX_PATH_LEN 4096
+
+// a small set of names, so that there are runs of equal siblings to compact
+char *names[] = {"systemd", "bash", "sshd", "kworker/0:1", "nginx", "postgres", "python3",
+                 "java", "containerd-shim", "sleep", "node", "(sd-pam)", "cron", "rsyslogd"};
+#define NAME_COUNT ((int)(sizeof(names) / sizeof(names[0])))
+
+char *root;
+int next_tid; // thread ids are handed out above the largest pid
+
+void write_file(const char *path, const char *data, size_t len)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL || fwrite(data, 1, len, file) != len || fclose(file) != 0)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void make_dir(const char *path)
+{
+    if (mkdir(path, 0755) < 0 && errno != EEXIST)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// same 52 fields as the kernel writes, with plausible values
+int format_stat(char *buf, size_t size, int pid, const char *name, int ppid, int threads)
+{
+    return snprintf(buf, size,
+                    "%d (%s) S %d %d %d 0 -1 4194560 %d 0 %d 0 %d %d 0 0 20 0 %d 0 %d "
+                    "%d %d 18446744073709551615 1 1 0 0 0 0 0 4096 0 0 0 0 17 %d 0 0 0 0 0 "
+                    "0 0 0 0 0 0 0 0\n",
+                    pid, name, ppid, pid, pid, 100 + pid % 900, pid % 7, pid % 50, pid % 30,
+                    threads + 1, 1000 + pid, 4096 * (pid % 64 + 1), 100 + pid % 4000, pid % 8);
+}
+
+void write_process(int pid, int ppid, int threads)
+{
+    char path[MAX_PATH_LEN], buf[512];
+    const char *name = pid == 1 ? "init" : names[(pid * 7 + ppid) % NAME_COUNT];
+
+    snprintf(path, sizeof(path), "%s/%d", root, pid);
+    make_dir(path);
+
+    snprintf(path, sizeof(path), "%s/%d/stat", root, pid);
+    write_file(path, buf, format_stat(buf, sizeof(buf), pid, name, ppid, threads));
+
+    // arguments are separated by '\0'
+    int len = snprintf(buf, sizeof(buf), "/usr/bin/%s%c--id=%d%c", name, 0, pid % 4, 0);
+    snprintf(path, sizeof(path), "%s/%d/cmdline", root, pid);
+    write_file(path, buf, len);
+
+    snprintf(path, sizeof(path), "%s/%d/task", root, pid);
+    make_dir(path);
+    for (int i = 0; i <= threads; i++)
+    {
+        // thread ids live above every process id, as if allocated later
+        int tid = i == 0 ? pid : next_tid++;
+        char thread_name[32];
+        if (i == 0)
+            snprintf(thread_name, sizeof(thread_name), "%s", name);
+        else
+            snprintf(thread_name, sizeof(thread_name), "worker-%d", i);
+
+        snprintf(path, sizeof(path), "%s/%d/task/%d", root, pid, tid);
+        make_dir(path);
+        snprintf(path, sizeof(path), "%s/%d/task/%d/comm", root, pid, tid);
+        len = snprintf(buf, sizeof(buf), "%s\n", thread_name);
+        write_file(path, buf, len);
+        snprintf(path, sizeof(path), "%s/%d/task/%d/stat", root, pid, tid);
+        write_file(path, buf, format_stat(buf, sizeof(buf), tid, thread_name, ppid, threads));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s DIR PROCESSES [THREADS [DEPTH [FANOUT]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    root = argv[1];
+    int processes = atoi(argv[2]);
+    int threads = argc > 3 ? atoi(argv[3]) : 0;
+    int depth = argc > 4 ? atoi(argv[4]) : 6;
+    int fanout = argc > 5 ? atoi(argv[5]) : 8;
+    if (processes < 1 || threads < 0 || depth < 1 || fanout < 1)
+    {
+        fprintf(stderr, "%s: bad tree shape\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    make_dir(root);
+    next_tid = processes + 1;
+
+    // breadth first: each process fills the next parent that still has room
+    // and is above the last level; once the tree is full the rest go under 1
+    int *level = malloc((processes + 1) * sizeof(int));
+    int parent = 1, children = 0;
+    level[1] = 0;
+    write_process(1, 0, threads);
+    for (int pid = 2; pid <= processes; pid++)
+    {
+        while (parent < pid && (children == fanout || level[parent] + 1 >= depth))
+        {
+            parent++;
+            children = 0;
+        }
+        int ppid = 1;
+        if (parent < pid)
+        {
+            ppid = parent;
+            children++;
+        }
+        level[pid] = level[ppid] + 1;
+        write_process(pid, ppid, threads);
+    }
+    free(level);
+    return 0;
+}
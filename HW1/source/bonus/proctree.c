@@ -0,0 +1,1421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "proctree.h"
+
+char *proctree_branch_chars_default[] = {"├", "└", "│", "─", "┬"};
+char *proctree_branch_chars_ascii[] = {"|", "`", "|", "-", "+"};
+
+// getdents64() record, glibc does not export it
+struct linux_dirent64
+{
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Every heap allocation of the library goes through here and is counted. A
+// failure leaves the old block as it was and is noted in pt->error; scan
+// workers allocate too, hence the atomics.
+static void *pt_realloc(proctree_t *pt, void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (p == NULL)
+    {
+        __atomic_store_n(&pt->error, ENOMEM, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    __atomic_fetch_add(&pt->allocations, 1, __ATOMIC_RELAXED);
+    return p;
+}
+
+// "PID" + suffix without going through printf
+static void format_pid_path(char *path, int pid, const char *suffix)
+{
+    char digits[16];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + pid % 10;
+        pid /= 10;
+    } while (pid > 0);
+    while (n > 0)
+    {
+        *path++ = digits[--n];
+    }
+    strcpy(path, suffix);
+}
+
+// numeric directory entry name to pid, -1 for anything else
+static int parse_pid(const char *name)
+{
+    int pid = 0;
+    if (*name == '\0')
+        return -1;
+    for (; *name; name++)
+    {
+        if (*name < '0' || *name > '9')
+            return -1;
+        pid = pid * 10 + (*name - '0');
+    }
+    return pid;
+}
+
+// Read a small /proc file with a single read(); procfs generates stat, comm
+// and cmdline in one go, so there is nothing to gain from stdio buffering.
+static ssize_t read_proc_file(int dirfd, const char *path, char *buf, size_t size)
+{
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+    return len;
+}
+
+// Fill *pids with the numeric entries of dirfd, listed by getdents64() in
+// large batches. The array is grown as needed and reused across calls; -1
+// if it could not grow.
+static int list_pids(proctree_t *pt, int dirfd, int **pids, int *capacity)
+{
+    char buf[DIRENT_BUF_SIZE];
+    int count = 0;
+    long len;
+
+    lseek(dirfd, 0, SEEK_SET);
+    while ((len = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0)
+    {
+        for (long pos = 0; pos < len;)
+        {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buf + pos);
+            pos += entry->d_reclen;
+
+            int pid = parse_pid(entry->d_name);
+            if (pid < 0)
+                continue;
+            if (count == *capacity)
+            {
+                int grown = *capacity ? *capacity * 2 : 1024;
+                int *bigger = pt_realloc(pt, *pids, grown * sizeof(int));
+                if (bigger == NULL)
+                    return -1;
+                *pids = bigger;
+                *capacity = grown;
+            }
+            (*pids)[count++] = pid;
+        }
+    }
+    return count;
+}
+
+static char *skip_fields(char *p, int count)
+{
+    while (count-- > 0 && *p)
+    {
+        while (*p == ' ')
+            p++;
+        while (*p && *p != ' ')
+            p++;
+    }
+    while (*p == ' ')
+        p++;
+    return p;
+}
+
+static unsigned long long parse_ull(char *p)
+{
+    unsigned long long value = 0;
+    while (*p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    return value;
+}
+
+// "pid (comm) state ppid ...": comm may hold spaces and parentheses, so it
+// ends at the last ')'. Returns 0 and fills name, ppid and the start time
+// on success.
+static int parse_stat(char *buf, char *name, size_t name_size, int *ppid, unsigned long long *start_time)
+{
+    char *open = strchr(buf, '(');
+    char *close = strrchr(buf, ')');
+    if (open == NULL || close == NULL || close < open || close[1] == '\0' || close[2] == '\0')
+        return -1;
+
+    size_t len = close - open - 1;
+    if (len >= name_size)
+        len = name_size - 1;
+    memcpy(name, open + 1, len);
+    name[len] = '\0';
+
+    char *p = close + 3; // skip ") S"
+    while (*p == ' ')
+        p++;
+    *ppid = (int)parse_ull(p);
+    *start_time = parse_ull(skip_fields(p, 18)); // fields 4..21 precede it
+    return 0;
+}
+
+// the pids in pt's /proc, into a caller's array that is grown as needed
+int proctree_list_pids(proctree_t *pt, int **pids, int *capacity)
+{
+    return list_pids(pt, pt->proc_fd, pids, capacity);
+}
+
+// --rollup: CPU time, thread count and resident set from the same stat line,
+// so no statm read is needed
+static void parse_stat_usage(char *buf, process_node_t *node)
+{
+    char *p = skip_fields(strrchr(buf, ')') + 1, 11); // to field 14, utime
+    node->cpu_ticks = parse_ull(p);
+    p = skip_fields(p, 1);
+    node->cpu_ticks += parse_ull(p);
+    p = skip_fields(p, 5);
+    node->thread_count = (int)parse_ull(p);
+    node->rss_pages = parse_ull(skip_fields(p, 4));
+}
+
+static int push_node(proctree_t *pt, process_node_t ***list, int *count, int *capacity, process_node_t *node)
+{
+    if (*count == *capacity)
+    {
+        int grown = *capacity ? *capacity * 2 : 1024;
+        process_node_t **bigger = pt_realloc(pt, *list, grown * sizeof(process_node_t *));
+        if (bigger == NULL)
+            return -1;
+        *list = bigger;
+        *capacity = grown;
+    }
+    (*list)[(*count)++] = node;
+    return 0;
+}
+
+// make room for count nodes in one of the context's scratch arrays, NULL if
+// there is none
+static process_node_t **reserve_nodes(proctree_t *pt, process_node_t ***list, int *capacity, int count)
+{
+    if (count > *capacity)
+    {
+        int grown = *capacity;
+        while (grown < count)
+            grown = grown ? grown * 2 : 1024;
+        process_node_t **bigger = pt_realloc(pt, *list, grown * sizeof(process_node_t *));
+        if (bigger == NULL)
+            return NULL;
+        *list = bigger;
+        *capacity = grown;
+    }
+    return *list;
+}
+
+// A failed write or growth is kept in o->error, like a stream's error flag,
+// and what could not be stored is dropped.
+void proctree_out_flush(output_t *o)
+{
+    size_t done = 0;
+    while (done < o->len)
+    {
+        ssize_t n = write(o->fd, o->data + done, o->len - done);
+        if (n <= 0)
+        {
+            o->error = n < 0 ? errno : EIO;
+            break;
+        }
+        done += n;
+    }
+    o->len = 0;
+}
+
+void proctree_out_write(output_t *o, const char *s, size_t len)
+{
+    if (len == 0)
+        return;
+    if (o->len + len > o->capacity)
+    {
+        size_t capacity = o->capacity;
+        while (o->len + len > capacity)
+            capacity = capacity ? capacity * 2 : 65536;
+        char *data = realloc(o->data, capacity);
+        if (data == NULL)
+        {
+            o->error = ENOMEM;
+            return;
+        }
+        o->data = data;
+        o->capacity = capacity;
+        o->allocations++;
+    }
+    memcpy(o->data + o->len, s, len);
+    o->len += len;
+    if (o->fd >= 0 && o->len >= OUTPUT_FLUSH_SIZE)
+        proctree_out_flush(o);
+}
+
+void proctree_out_puts(output_t *o, const char *s)
+{
+    proctree_out_write(o, s, strlen(s));
+}
+
+static void *arena_alloc(proctree_t *pt, arena_t *arena, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    arena_chunk_t *chunk = arena->current;
+    if (chunk == NULL || chunk->used + size > chunk->size)
+    {
+        // move on to the next chunk kept from before a reset, if it is big enough
+        arena_chunk_t **next = chunk ? &chunk->next : &arena->head;
+        if (*next == NULL || (*next)->size < size)
+        {
+            size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+            arena_chunk_t *fresh = pt_realloc(pt, NULL, sizeof(arena_chunk_t) + chunk_size);
+            if (fresh == NULL)
+                return NULL;
+            fresh->size = chunk_size;
+            fresh->next = *next;
+            *next = fresh;
+        }
+        chunk = arena->current = *next;
+        chunk->used = 0;
+    }
+    void *p = chunk->data + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+static void arena_free(arena_t *arena)
+{
+    while (arena->head != NULL)
+    {
+        arena_chunk_t *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->current = NULL;
+}
+
+static char *arena_strndup(proctree_t *pt, arena_t *arena, const char *s, size_t len)
+{
+    char *copy = arena_alloc(pt, arena, len + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static unsigned int hash_name(const char *s)
+{
+    unsigned int hash = 2166136261u; // FNV-1a
+    for (; *s; s++)
+        hash = (hash ^ (unsigned char)*s) * 16777619u;
+    return hash;
+}
+
+// Most tasks share a handful of names (kworker, bash, {java}...), so each
+// distinct name is stored once and nodes point at it. NULL if it cannot be.
+static const char *intern_name(proctree_t *pt, name_set_t *set, arena_t *arena, const char *name)
+{
+    if (set->count * 2 >= (int)set->mask)
+    {
+        unsigned int old_size = set->table ? set->mask + 1 : 0;
+        unsigned int mask = old_size ? old_size * 2 - 1 : 1023;
+        char **table = pt_realloc(pt, NULL, (mask + 1) * sizeof(char *));
+        if (table == NULL)
+            return NULL;
+        char **old_table = set->table;
+        set->table = table;
+        set->mask = mask;
+        memset(set->table, 0, (set->mask + 1) * sizeof(char *));
+        for (unsigned int i = 0; i < old_size; i++)
+        {
+            if (old_table[i] == NULL)
+                continue;
+            unsigned int slot = hash_name(old_table[i]) & set->mask;
+            while (set->table[slot])
+                slot = (slot + 1) & set->mask;
+            set->table[slot] = old_table[i];
+        }
+        free(old_table);
+    }
+
+    unsigned int slot = hash_name(name) & set->mask;
+    for (; set->table[slot]; slot = (slot + 1) & set->mask)
+    {
+        if (strcmp(set->table[slot], name) == 0)
+            return set->table[slot];
+    }
+    set->table[slot] = arena_strndup(pt, arena, name, strlen(name));
+    if (set->table[slot] == NULL)
+        return NULL;
+    set->count++;
+    return set->table[slot];
+}
+
+const char *proctree_intern(proctree_t *pt, const char *name)
+{
+    return intern_name(pt, &pt->name_set, &pt->node_arena, name);
+}
+
+// Names are interned in pt->name_set, so a name's slot identifies it, e.g. as
+// an index into a caller's per-name table of name_set.mask + 1 entries. A name
+// that somehow was not interned gets the empty slot it would go in rather
+// than a probe that never ends.
+unsigned int proctree_name_slot(proctree_t *pt, const char *name)
+{
+    name_set_t *set = &pt->name_set;
+    unsigned int slot = hash_name(name) & set->mask;
+    while (set->table[slot] != NULL && set->table[slot] != name && strcmp(set->table[slot], name) != 0)
+        slot = (slot + 1) & set->mask;
+    return slot;
+}
+
+// empty the set but keep its table for the next scan
+static void clear_names(name_set_t *set)
+{
+    if (set->table != NULL)
+        memset(set->table, 0, (set->mask + 1) * sizeof(char *));
+    set->count = 0;
+}
+
+static process_node_t *new_node(scan_worker_t *w, int pid, int ppid, const char *name)
+{
+    process_node_t *node = w->free_nodes;
+    char *cmdline_buffer = NULL;
+    size_t cmdline_size = 0;
+    if (node != NULL)
+    {
+        w->free_nodes = node->parent;
+        cmdline_buffer = node->cmdline_buffer;
+        cmdline_size = node->cmdline_size;
+    }
+    else
+        node = arena_alloc(w->pt, &w->arena, sizeof(process_node_t) + w->pt->node_data_size);
+    if (node == NULL)
+        return NULL;
+    memset(node, 0, sizeof(*node) + w->pt->node_data_size);
+    node->cmdline_buffer = cmdline_buffer;
+    node->cmdline_size = cmdline_size;
+    node->pid = pid;
+    node->ppid = ppid;
+    node->name = intern_name(w->pt, &w->names, &w->arena, name);
+    if (node->name == NULL || push_node(w->pt, &w->nodes, &w->node_count, &w->node_capacity, node) < 0)
+    {
+        proctree_recycle(w, node); // for the next try
+        return NULL;
+    }
+    return node;
+}
+
+static unsigned int hash_pid(int pid)
+{
+    return (unsigned int)pid * 2654435761u;
+}
+
+process_node_t *proctree_find(proctree_t *pt, int pid)
+{
+    if (pt->pid_table == NULL)
+        return NULL;
+    for (unsigned int slot = hash_pid(pid) & pt->pid_table_mask; pt->pid_table[slot];
+         slot = (slot + 1) & pt->pid_table_mask)
+    {
+        if (pt->pid_table[slot]->pid == pid)
+            return pt->pid_table[slot];
+    }
+    return NULL;
+}
+
+static void insert_pid_table(proctree_t *pt, process_node_t *node)
+{
+    unsigned int slot = hash_pid(node->pid) & pt->pid_table_mask;
+    while (pt->pid_table[slot])
+        slot = (slot + 1) & pt->pid_table_mask;
+    pt->pid_table[slot] = node;
+}
+
+// append to process_list and index it, keeping the table at most half full
+static int add_process(proctree_t *pt, process_node_t *node)
+{
+    if (pt->process_count == pt->process_capacity)
+    {
+        // the old table stays in use until both arrays have grown
+        int capacity = pt->process_capacity ? pt->process_capacity * 2 : 1024;
+        process_node_t **list = pt_realloc(pt, pt->process_list, capacity * sizeof(process_node_t *));
+        if (list == NULL)
+            return -1;
+        pt->process_list = list;
+        process_node_t **table = pt_realloc(pt, pt->pid_table, capacity * 2 * sizeof(process_node_t *));
+        if (table == NULL)
+            return -1;
+        pt->pid_table = table;
+        pt->process_capacity = capacity;
+        memset(pt->pid_table, 0, pt->process_capacity * 2 * sizeof(process_node_t *));
+        pt->pid_table_mask = pt->process_capacity * 2 - 1;
+        for (int i = 0; i < pt->process_count; i++)
+            insert_pid_table(pt, pt->process_list[i]);
+    }
+    node->index = pt->process_count;
+    pt->process_list[pt->process_count++] = node;
+    insert_pid_table(pt, node);
+    return 0;
+}
+
+// Take a node out of process_list and the pid table. Linear probing needs
+// the entries after it shifted back so that no probe chain is broken.
+void proctree_remove(proctree_t *pt, process_node_t *node)
+{
+    process_node_t **pid_table = pt->pid_table;
+    unsigned int mask = pt->pid_table_mask;
+    unsigned int slot = hash_pid(node->pid) & mask;
+    while (pid_table[slot] != node)
+        slot = (slot + 1) & mask;
+
+    unsigned int hole = slot;
+    for (slot = (hole + 1) & mask; pid_table[slot]; slot = (slot + 1) & mask)
+    {
+        unsigned int home = hash_pid(pid_table[slot]->pid) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            pid_table[hole] = pid_table[slot];
+            hole = slot;
+        }
+    }
+    pid_table[hole] = NULL;
+
+    pt->process_list[node->index] = pt->process_list[--pt->process_count];
+    pt->process_list[node->index]->index = node->index;
+}
+
+int proctree_is_listed(proctree_t *pt, process_node_t *node)
+{
+    return node->index < pt->process_count && pt->process_list[node->index] == node;
+}
+
+// a node read by a worker joins the tree; its name is interned in the tree's set
+int proctree_add_node(proctree_t *pt, process_node_t *node)
+{
+    const char *name = intern_name(pt, &pt->name_set, &pt->node_arena, node->name);
+    if (name == NULL)
+        return pt->error;
+    node->name = name;
+    return add_process(pt, node) < 0 ? pt->error : 0;
+}
+
+// a process that does not come from /proc, e.g. one replayed from a log
+process_node_t *proctree_add_process(proctree_t *pt, int pid, int ppid, const char *name)
+{
+    process_node_t *node = arena_alloc(pt, &pt->node_arena, sizeof(process_node_t) + pt->node_data_size);
+    if (node == NULL)
+        return NULL;
+    memset(node, 0, sizeof(*node) + pt->node_data_size);
+    node->pid = pid;
+    node->ppid = ppid;
+    node->name = name;
+    return proctree_add_node(pt, node) == 0 ? node : NULL;
+}
+
+// A caller keeps its own per-node state (watch mode's pidfds, for one) in
+// node_data_size bytes right after each node, so it lives and is reused
+// with the node.
+void *proctree_node_data(process_node_t *node)
+{
+    return node + 1;
+}
+
+// A removed node that nothing points at any more, for w to fill with the
+// next process it reads.
+void proctree_recycle(scan_worker_t *w, process_node_t *node)
+{
+    node->parent = w->free_nodes;
+    w->free_nodes = node;
+}
+
+static int read_process_cmdline(scan_worker_t *w, int pid, process_node_t *node)
+{
+    char path[32], cmdline[MAX_CMDLINE_LEN];
+    format_pid_path(path, pid, "/cmdline");
+    ssize_t len = read_proc_file(w->pt->proc_fd, path, cmdline, sizeof(cmdline));
+    if (len > 0)
+    {
+        for (ssize_t i = 0; i < len; i++)
+        {
+            if (cmdline[i] == '\0')
+            {
+                cmdline[i] = ' ';
+            }
+        }
+
+        while (len > 0 && isspace((unsigned char)cmdline[len - 1]))
+        {
+            cmdline[--len] = '\0';
+        }
+        if (len > 0)
+        {
+            if ((size_t)len >= node->cmdline_size)
+            {
+                size_t size = len < 64 ? 64 : len + 1;
+                char *buffer = arena_alloc(w->pt, &w->arena, size);
+                if (buffer == NULL)
+                    return -1;
+                node->cmdline_buffer = buffer;
+                node->cmdline_size = size;
+            }
+            memcpy(node->cmdline_buffer, cmdline, len + 1);
+            node->cmdline = node->cmdline_buffer;
+        }
+    }
+    else
+    {
+        node->cmdline = "()";
+    }
+    return 0;
+}
+
+// Threads are listed from /proc/PID/task; their own names are only read
+// (from comm) when -t asks for them.
+int proctree_read_threads(scan_worker_t *w, process_node_t *node)
+{
+    char path[32];
+    int pid = node->pid;
+
+    format_pid_path(path, pid, "/task");
+    int task_fd = openat(w->pt->proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (task_fd < 0)
+        return 0; // the process has exited meanwhile
+
+    int count = list_pids(w->pt, task_fd, &w->tids, &w->tid_capacity);
+    for (int i = 0; i < count; i++)
+    {
+        int tid = w->tids[i];
+        if (tid == pid)
+            continue;
+
+        char thread_name[MAX_NAME_LEN], name[MAX_NAME_LEN + 2];
+        if (w->pt->use_thread_names)
+        {
+            format_pid_path(path, tid, "/comm");
+            ssize_t len = read_proc_file(task_fd, path, thread_name, sizeof(thread_name));
+            if (len < 0)
+                continue; // the thread has exited meanwhile
+            if (len > 0 && thread_name[len - 1] == '\n')
+                thread_name[len - 1] = '\0';
+        }
+
+        snprintf(name, sizeof(name), "{%s}", w->pt->use_thread_names ? thread_name : node->name);
+        process_node_t *thread_node = new_node(w, tid, pid, name);
+        if (thread_node == NULL)
+        {
+            count = -1;
+            break;
+        }
+        thread_node->is_thread = 1;
+    }
+    close(task_fd);
+    return count < 0 ? w->pt->error : 0;
+}
+
+static int read_process_details(scan_worker_t *w, int pid, process_node_t *node)
+{
+    // a second read would add the threads again
+    if (node->details_read)
+        return 0;
+    node->details_read = 1;
+
+    if (w->pt->show_threads && proctree_read_threads(w, node) != 0)
+    {
+        return -1;
+    }
+
+    if (w->pt->show_cmdline && read_process_cmdline(w, pid, node) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+process_node_t *proctree_read_process(scan_worker_t *w, int pid)
+{
+    proctree_t *pt = w->pt;
+    char path[32], buf[STAT_BUF_SIZE], name[MAX_NAME_LEN];
+    int ppid;
+    unsigned long long start_time;
+
+    format_pid_path(path, pid, "/stat");
+    if (read_proc_file(pt->proc_fd, path, buf, sizeof(buf)) < 0)
+        return NULL;
+    if (parse_stat(buf, name, sizeof(name), &ppid, &start_time) < 0)
+        return NULL;
+
+    process_node_t *node = new_node(w, pid, ppid, name);
+    if (node == NULL)
+        return NULL;
+    node->start_time = start_time;
+    if (pt->show_rollup)
+        parse_stat_usage(buf, node);
+
+    if (pt->filter_uid >= 0)
+    {
+        struct stat st;
+        format_pid_path(path, pid, "");
+        node->uid = fstatat(pt->proc_fd, path, &st, 0) == 0 ? (int)st.st_uid : -1;
+    }
+
+    if (!pt->lazy_details && read_process_details(w, pid, node) < 0)
+    {
+        return NULL;
+    }
+    return node;
+}
+
+// Read stat again for a process in the tree: follow a reparenting and, with
+// --rollup, its usage. Returns 0 when the pid is gone or belongs to another
+// program by now (a different start time or name), for the caller to drop
+// the node and read the pid as a new process.
+int proctree_reread(proctree_t *pt, process_node_t *node)
+{
+    char path[32], buf[STAT_BUF_SIZE], name[MAX_NAME_LEN];
+    int ppid;
+    unsigned long long start_time;
+
+    format_pid_path(path, node->pid, "/stat");
+    if (read_proc_file(pt->proc_fd, path, buf, sizeof(buf)) < 0 ||
+        parse_stat(buf, name, sizeof(name), &ppid, &start_time) < 0)
+        return 0;
+    if (start_time != node->start_time || strcmp(name, node->name) != 0)
+        return 0;
+    node->ppid = ppid;
+    if (pt->show_rollup)
+        parse_stat_usage(buf, node);
+    return 1;
+}
+
+static int compare_by_name(process_node_t *a, process_node_t *b)
+{
+    int order = strcmp(a->name, b->name);
+    return order ? order : a->pid - b->pid; // same order whatever the scan order
+}
+
+static int compare_by_pid(process_node_t *a, process_node_t *b)
+{
+    return a->pid - b->pid;
+}
+
+// Bottom-up merge sort into the context's scratch array: glibc's qsort()
+// mallocs a buffer for all but small arrays, which a rescan must not do.
+static int sort_nodes(proctree_t *pt, process_node_t **nodes, int count,
+                      int (*compare)(process_node_t *, process_node_t *))
+{
+    process_node_t **from = nodes;
+    process_node_t **to = reserve_nodes(pt, &pt->sort_buffer, &pt->sort_capacity, count);
+    if (to == NULL)
+        return -1;
+
+    // short runs by insertion sort, then merge them pairwise
+    int run = 8;
+    for (int start = 0; start < count; start += run)
+    {
+        int end = start + run < count ? start + run : count;
+        for (int i = start + 1; i < end; i++)
+        {
+            process_node_t *node = nodes[i];
+            int j = i;
+            for (; j > start && compare(nodes[j - 1], node) > 0; j--)
+                nodes[j] = nodes[j - 1];
+            nodes[j] = node;
+        }
+    }
+    for (; run < count; run *= 2)
+    {
+        for (int start = 0; start < count; start += 2 * run)
+        {
+            int middle = start + run < count ? start + run : count;
+            int end = start + 2 * run < count ? start + 2 * run : count;
+            int i = start, j = middle, k = start;
+            while (i < middle && j < end)
+                to[k++] = compare(from[j], from[i]) < 0 ? from[j++] : from[i++];
+            while (i < middle)
+                to[k++] = from[i++];
+            while (j < end)
+                to[k++] = from[j++];
+        }
+        process_node_t **swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != nodes)
+        memcpy(nodes, from, count * sizeof(process_node_t *));
+    return 0;
+}
+
+static int sort_children(proctree_t *pt, process_node_t *node)
+{
+    if (node->child_count > 1)
+    {
+        return sort_nodes(pt, node->children, node->child_count, pt->sort_by_pid ? compare_by_pid : compare_by_name);
+    }
+    return 0;
+}
+
+static void scan_worker_main(scan_worker_t *w)
+{
+    proctree_t *pt = w->pt;
+    int chunk;
+    while ((chunk = __atomic_fetch_add(&pt->next_scan_chunk, 1, __ATOMIC_RELAXED)) < pt->scan_chunk_count)
+    {
+        scan_chunk_t *c = &pt->scan_chunks[chunk];
+        int end = (chunk + 1) * SCAN_CHUNK_SIZE;
+        if (end > pt->scan_pid_count)
+            end = pt->scan_pid_count;
+
+        c->worker = w;
+        c->first = w->node_count;
+        for (int i = chunk * SCAN_CHUNK_SIZE; i < end; i++)
+        {
+            proctree_read_process(w, pt->scan_pids[i]);
+        }
+        c->count = w->node_count - c->first;
+    }
+}
+
+// Pool threads sleep between scans instead of being created for each one.
+static void *scan_worker_thread(void *arg)
+{
+    scan_worker_t *w = arg;
+    proctree_t *pt = w->pt;
+    for (;;)
+    {
+        pthread_mutex_lock(&pt->pool_lock);
+        while (w->generation == pt->scan_generation && !pt->stopping)
+            pthread_cond_wait(&pt->scan_start, &pt->pool_lock);
+        w->generation = pt->scan_generation;
+        int stopping = pt->stopping;
+        pthread_mutex_unlock(&pt->pool_lock);
+        if (stopping)
+            return NULL;
+
+        scan_worker_main(w);
+
+        pthread_mutex_lock(&pt->pool_lock);
+        if (--pt->workers_running == 0)
+            pthread_cond_signal(&pt->scan_done);
+        pthread_mutex_unlock(&pt->pool_lock);
+    }
+}
+
+// the pool is sized by the first scan and kept
+static void start_scan_workers(proctree_t *pt)
+{
+    int threads = pt->scan_threads;
+    if (threads == 0)
+    {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads > 8)
+            threads = 8;
+        if (threads > pt->scan_pid_count / MIN_PIDS_PER_THREAD)
+            threads = pt->scan_pid_count / MIN_PIDS_PER_THREAD;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_SCAN_THREADS)
+        threads = MAX_SCAN_THREADS;
+
+    // the calling thread is worker 0
+    pt->worker_count = 1;
+    for (int i = 1; i < threads; i++)
+    {
+        pt->workers[i].generation = pt->scan_generation;
+        if (pthread_create(&pt->workers[i].thread, NULL, scan_worker_thread, &pt->workers[i]) != 0)
+            break; // the others pick up its share
+        pt->worker_count++;
+    }
+}
+
+// forget every process; the memory is kept for the next scan
+static void reset_processes(proctree_t *pt)
+{
+    for (int i = 0; i < MAX_SCAN_THREADS; i++)
+    {
+        pt->workers[i].arena.current = NULL;
+        clear_names(&pt->workers[i].names);
+        pt->workers[i].node_count = 0;
+    }
+    pt->node_arena.current = NULL;
+    clear_names(&pt->name_set);
+    if (pt->pid_table != NULL)
+        memset(pt->pid_table, 0, (pt->pid_table_mask + 1) * sizeof(process_node_t *));
+    pt->process_count = 0;
+}
+
+// Reading /proc is bound by per-file syscall latency, so the pid list is cut
+// into chunks that a pool of workers claims one at a time. The workers' nodes
+// are then merged chunk by chunk, which gives the same order as a serial scan.
+int proctree_read(proctree_t *pt)
+{
+    pt->error = 0;
+    if (pt->proc_fd < 0)
+        pt->proc_fd = open(pt->proc_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pt->proc_fd < 0)
+        return pt->error = errno;
+    reset_processes(pt);
+
+    pt->scan_pid_count = list_pids(pt, pt->proc_fd, &pt->scan_pids, &pt->scan_pid_capacity);
+    if (pt->scan_pid_count < 0)
+    {
+        pt->scan_pid_count = 0;
+        return pt->error;
+    }
+    pt->scan_chunk_count = (pt->scan_pid_count + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+    pt->next_scan_chunk = 0;
+    if (pt->scan_chunk_count > pt->scan_chunk_capacity)
+    {
+        scan_chunk_t *chunks = pt_realloc(pt, pt->scan_chunks, pt->scan_chunk_count * 2 * sizeof(scan_chunk_t));
+        if (chunks == NULL)
+            return pt->error;
+        pt->scan_chunks = chunks;
+        pt->scan_chunk_capacity = pt->scan_chunk_count * 2;
+    }
+
+    if (pt->worker_count == 0)
+        start_scan_workers(pt);
+
+    pthread_mutex_lock(&pt->pool_lock);
+    pt->workers_running = pt->worker_count - 1;
+    pt->scan_generation++;
+    pthread_cond_broadcast(&pt->scan_start);
+    pthread_mutex_unlock(&pt->pool_lock);
+
+    scan_worker_main(&pt->workers[0]);
+
+    pthread_mutex_lock(&pt->pool_lock);
+    while (pt->workers_running > 0)
+        pthread_cond_wait(&pt->scan_done, &pt->pool_lock);
+    pthread_mutex_unlock(&pt->pool_lock);
+
+    for (int i = 0; i < pt->scan_chunk_count; i++)
+    {
+        scan_chunk_t *c = &pt->scan_chunks[i];
+        for (int j = c->first; j < c->first + c->count; j++)
+        {
+            if (proctree_add_node(pt, c->worker->nodes[j]) != 0)
+                return pt->error;
+        }
+    }
+    return pt->error; // a worker may have failed
+}
+
+// In breadth-first order every child comes after its parent, so walking that
+// order backwards is a post-order: each subtree total is complete before it is
+// added to the parent's.
+static int rollup_process_tree(proctree_t *pt)
+{
+    process_node_t **order = reserve_nodes(pt, &pt->order, &pt->order_capacity, pt->process_count);
+    if (order == NULL)
+        return -1;
+
+    int count = 0;
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        process_node_t *node = pt->process_list[i];
+        if (node->parent == NULL)
+            order[count++] = node;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        process_node_t *node = order[i];
+        node->total_cpu_ticks = node->cpu_ticks;
+        node->total_rss_pages = node->rss_pages;
+        node->total_threads = node->thread_count; // 0 for thread nodes, counted by their process
+        for (int j = 0; j < node->child_count; j++)
+            order[count++] = node->children[j];
+    }
+    for (int i = count - 1; i > 0; i--)
+    {
+        process_node_t *node = order[i];
+        if (node->parent != NULL)
+        {
+            node->parent->total_cpu_ticks += node->total_cpu_ticks;
+            node->parent->total_rss_pages += node->total_rss_pages;
+            node->parent->total_threads += node->total_threads;
+        }
+    }
+    return 0;
+}
+
+// Children are stored compressed-sparse-row style: count every parent's
+// children, hand out consecutive ranges of child_list, then fill them in
+// scan order. No per-node array, so no limit on the number of children.
+int proctree_build(proctree_t *pt)
+{
+    process_node_t **child_list = reserve_nodes(pt, &pt->child_list, &pt->child_capacity, pt->process_count);
+    if (child_list == NULL)
+        return pt->error;
+
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        pt->process_list[i]->child_count = 0;
+    }
+
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        process_node_t *node = pt->process_list[i];
+        node->parent = node->ppid > 0 ? proctree_find(pt, node->ppid) : NULL;
+        if (node->parent != NULL)
+            node->parent->child_count++;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        process_node_t *node = pt->process_list[i];
+        node->children = child_list + offset;
+        offset += node->child_count;
+        node->child_count = 0;
+    }
+
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        process_node_t *node = pt->process_list[i];
+        if (node->parent != NULL)
+            node->parent->children[node->parent->child_count++] = node;
+    }
+
+    if (pt->show_rollup && rollup_process_tree(pt) < 0)
+        return pt->error;
+    return 0;
+}
+
+int proctree_sort(proctree_t *pt)
+{
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        if (sort_children(pt, pt->process_list[i]) < 0)
+            return pt->error;
+    }
+    return 0;
+}
+
+// pstree PID prints the tree of PID; pstree USER prints every tree whose root
+// belongs to USER while no ancestor does, as the ancestor's tree shows it already
+int proctree_is_selected(proctree_t *pt, process_node_t *node)
+{
+    if (pt->filter_uid < 0)
+        return node->pid == pt->root_pid;
+    if (node->is_thread || node->uid != pt->filter_uid)
+        return 0;
+    // bounded, since a --proc tree may link its ppids into a loop
+    int steps = pt->process_count;
+    for (process_node_t *p = node->parent; p != NULL && steps-- > 0; p = p->parent)
+    {
+        if (p->uid == pt->filter_uid)
+            return 0;
+    }
+    return 1;
+}
+
+// In lazy mode the scan read stat alone, which is enough to link the tree.
+// Threads and cmdlines are read here for the selected subtrees only, and the
+// new thread nodes are linked in by a second build.
+int proctree_read_details(proctree_t *pt)
+{
+    scan_worker_t *w = &pt->workers[0];
+    int first = w->node_count;
+    process_node_t **stack = reserve_nodes(pt, &pt->order, &pt->order_capacity, pt->process_count);
+    if (stack == NULL)
+        return pt->error;
+
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        if (!proctree_is_selected(pt, pt->process_list[i]))
+            continue;
+        int depth = 0;
+        stack[depth++] = pt->process_list[i];
+        while (depth > 0)
+        {
+            process_node_t *node = stack[--depth];
+            if (read_process_details(w, node->pid, node) < 0)
+                return pt->error;
+            for (int j = 0; j < node->child_count; j++)
+            {
+                stack[depth++] = node->children[j];
+            }
+        }
+    }
+
+    for (int i = first; i < w->node_count; i++)
+    {
+        if (proctree_add_node(pt, w->nodes[i]) != 0)
+            return pt->error;
+    }
+    return proctree_build(pt);
+}
+
+// " [rss 12.3M cpu 4.5s thr 7]" for the subtree rooted at node
+static void format_rollup(proctree_t *pt, char *buf, size_t size, process_node_t *node)
+{
+    double rss = (double)node->total_rss_pages * pt->page_size / 1024;
+    char unit = 'K';
+    if (rss >= 1024)
+    {
+        rss /= 1024;
+        unit = 'M';
+    }
+    if (rss >= 1024)
+    {
+        rss /= 1024;
+        unit = 'G';
+    }
+    snprintf(buf, size, " [rss %.*f%c cpu %.1fs thr %d]", rss < 10 && unit != 'K' ? 1 : 0, rss, unit,
+             (double)node->total_cpu_ticks / pt->ticks_per_second, node->total_threads);
+}
+
+// Leaves print as one "N*[name]" line when they are identical: same name,
+// and with -a the same command line. Children are sorted by name, so
+// identical leaves are always next to each other.
+static int same_leaf(proctree_t *pt, process_node_t *a, process_node_t *b)
+{
+    if (a->child_count != 0 || b->child_count != 0 || a->name != b->name) // names are interned
+        return 0;
+    if (pt->show_rollup && !a->is_thread) // each process has its own usage
+        return 0;
+    if (a->cmdline == b->cmdline)
+        return 1;
+    return a->cmdline && b->cmdline && strcmp(a->cmdline, b->cmdline) == 0;
+}
+
+// grow the per-column arrays to hold columns [0, count); bar_columns only
+// moves once all three have
+static int ensure_bar_columns(proctree_t *pt, int count)
+{
+    if (count <= pt->bar_columns)
+        return 0;
+    int columns = pt->bar_columns;
+    while (columns < count)
+        columns = columns ? columns * 2 : 256;
+    int *recorder = pt_realloc(pt, pt->branch_bar_recorder, columns * sizeof(int));
+    if (recorder == NULL)
+        return -1;
+    pt->branch_bar_recorder = recorder;
+    size_t *prefix_end = pt_realloc(pt, pt->bar_prefix_end, (columns + 1) * sizeof(size_t));
+    if (prefix_end == NULL)
+        return -1;
+    pt->bar_prefix_end = prefix_end;
+    char *prefix = pt_realloc(pt, pt->bar_prefix, columns * 6 + 1); // "  " + 3-byte glyph + " "
+    if (prefix == NULL)
+        return -1;
+    pt->bar_prefix = prefix;
+    memset(pt->branch_bar_recorder + pt->bar_columns, 0, (columns - pt->bar_columns) * sizeof(int));
+    pt->bar_columns = columns;
+    pt->bar_prefix_end[0] = 0;
+    return 0;
+}
+
+static void set_bar(proctree_t *pt, int column, int is_print)
+{
+    if (column < 0 || ensure_bar_columns(pt, column + 1) < 0)
+        return;
+    if (pt->branch_bar_recorder[column] != is_print)
+    {
+        pt->branch_bar_recorder[column] = is_print;
+        if (pt->bar_prefix_valid > column)
+            pt->bar_prefix_valid = column;
+    }
+}
+
+// Copy the bars of columns [0, depth) into the output, rendering only the
+// columns that changed since the previous line.
+static void print_bars(proctree_t *pt, int depth)
+{
+    if (ensure_bar_columns(pt, depth) < 0)
+        return; // proctree_print() reports it
+    for (int i = pt->bar_prefix_valid; i < depth; i++)
+    {
+        char *p = pt->bar_prefix + pt->bar_prefix_end[i];
+        if (!pt->align_mode)
+        {
+            memcpy(p, "  ", 2);
+            p += 2;
+        }
+        const char *bar = pt->branch_bar_recorder[i] ? pt->branch_chars[2] : " ";
+        size_t len = strlen(bar);
+        memcpy(p, bar, len);
+        p += len;
+        if (!pt->align_mode)
+            *p++ = ' ';
+        pt->bar_prefix_end[i + 1] = p - pt->bar_prefix;
+    }
+    if (pt->bar_prefix_valid < depth)
+        pt->bar_prefix_valid = depth;
+    if (depth > 0)
+        proctree_out_write(&pt->out, pt->bar_prefix, pt->bar_prefix_end[depth]);
+}
+
+// group_count > 1 prints the node as "N*[name]" for that many identical leaves
+static void print_process_tree(proctree_t *pt, process_node_t *node, int group_count, int depth, int is_last_child,
+                        int is_first_child)
+{
+    char **branch_chars = pt->branch_chars;
+    int align_mode = pt->align_mode;
+
+    // Print the tree structure
+    char *branch_prefix = branch_chars[0];
+    if (is_last_child == 1)
+    {
+        branch_prefix = branch_chars[1];
+    }
+
+    if (align_mode)
+    {
+        set_bar(pt, depth + 1, is_last_child ? 0 : 1);
+    }
+    else
+    {
+        set_bar(pt, depth, is_last_child ? 0 : 1);
+    }
+
+    if (!(align_mode && is_first_child))
+        print_bars(pt, depth);
+
+    const char *name_p = node->name;
+    char name[260] = "";
+
+    if (node->cmdline != NULL)
+    {
+        // Remove the absolute path of the command
+        char *cmdline = node->cmdline;
+        // Get the last space position
+        char *first_name_occur = strstr(cmdline, " ");
+        char *last_slash = NULL;
+
+        if (first_name_occur)
+        {
+            // find the last slash before the first space
+            last_slash = first_name_occur;
+            while (last_slash > cmdline && *last_slash != '/')
+            {
+                last_slash--;
+            }
+
+            if (*last_slash == '/')
+            {
+                last_slash++; // skip the slash
+            }
+            else
+            {
+                last_slash = cmdline;
+            }
+
+            // copy the name
+            name_p = last_slash;
+            strncpy(name, name_p, sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+        }
+        else
+        {
+            name_p = cmdline;
+            strncpy(name, name_p, sizeof(name) - 1);
+            name[sizeof(name) - 1] = '\0';
+        }
+    }
+    else
+    {
+        // use the name if cmdline is empty
+        strncpy(name, name_p, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+    }
+
+    // room for the whole name plus "N*[" and "]", so a group never cuts it short
+    const char *label = name;
+    char grouped[sizeof(name) + 16];
+    if (group_count > 1)
+    {
+        snprintf(grouped, sizeof(grouped), "%d*[%s]", group_count, name);
+        label = grouped;
+    }
+
+    if (align_mode && is_first_child)
+    {
+        branch_prefix = branch_chars[4];
+        if (is_last_child)
+        {
+            branch_prefix = branch_chars[3];
+        }
+    }
+    char *sep = branch_chars[3];
+
+    char depth_prefix[20] = "";
+    int depth_prefix_len = 0;
+    // format depth prefix
+    if (depth != -1)
+    {
+        if (align_mode)
+        {
+            if (is_first_child)
+            {
+                snprintf(depth_prefix, sizeof(depth_prefix), "%s%s%s", sep, branch_prefix, sep);
+                depth_prefix_len = 3;
+            }
+            else
+            {
+                snprintf(depth_prefix, sizeof(depth_prefix), " %s%s", branch_prefix, sep);
+                depth_prefix_len = 3;
+            }
+        }
+        else
+        {
+            snprintf(depth_prefix, sizeof(depth_prefix), "  %s%s", branch_prefix, sep);
+            depth_prefix_len = 4;
+        }
+    }
+
+    char output[1024] = "";
+
+    // debug use
+    // for (int i = 0; i < strlen(name); i++)
+    // {
+    //     printf("%c (%d)\n", name[i], (unsigned char)name[i]);
+    // }
+
+    if (pt->show_pid)
+        snprintf(output, sizeof(output), "%s(%d)", label, node->pid);
+    else
+        snprintf(output, sizeof(output), "%s", label);
+
+    if (pt->show_rollup && !node->is_thread)
+    {
+        size_t len = strlen(output);
+        format_rollup(pt, output + len, sizeof(output) - len, node);
+    }
+
+    int offset = 0;
+
+    if (align_mode)
+    {
+        // all subnode adding depth(offset) by output length
+        if (depth != -1)
+            offset += depth_prefix_len;
+        else
+            offset += 1;
+        offset += strlen(output);
+    }
+    else
+    {
+        offset += 1;
+    }
+
+    proctree_out_puts(&pt->out, depth_prefix);
+    proctree_out_puts(&pt->out, output);
+
+    if (align_mode)
+    {
+        if (node->child_count == 0)
+        {
+            proctree_out_write(&pt->out, "\n", 1);
+        }
+    }
+    else
+    {
+        proctree_out_write(&pt->out, "\n", 1);
+    }
+
+    // one pass over the children, each run of identical leaves printed once
+    for (int i = 0; i < node->child_count;)
+    {
+        int run = 1;
+        if (pt->show_compact)
+        {
+            while (i + run < node->child_count && same_leaf(pt, node->children[i], node->children[i + run]))
+                run++;
+        }
+
+        int last = i + run - 1; // the run is shown with its last pid
+        print_process_tree(pt, node->children[last], run, depth + offset, last == node->child_count - 1, i == 0);
+        i += run;
+    }
+}
+
+void proctree_init(proctree_t *pt)
+{
+    memset(pt, 0, sizeof(*pt));
+    pt->proc_root = PROC_PREFIX;
+    pt->show_threads = 1;
+    pt->show_compact = 1;
+    pt->align_mode = 1;
+    pt->branch_chars = proctree_branch_chars_default;
+    pt->root_pid = 1;
+    pt->filter_uid = -1;
+    pt->proc_fd = -1;
+    pt->out.fd = STDOUT_FILENO;
+    pt->page_size = sysconf(_SC_PAGESIZE);
+    pt->ticks_per_second = sysconf(_SC_CLK_TCK);
+    for (int i = 0; i < MAX_SCAN_THREADS; i++)
+        pt->workers[i].pt = pt;
+    pthread_mutex_init(&pt->pool_lock, NULL);
+    pthread_cond_init(&pt->scan_start, NULL);
+    pthread_cond_init(&pt->scan_done, NULL);
+}
+
+int proctree_scan(proctree_t *pt)
+{
+    if (proctree_read(pt) != 0 || proctree_build(pt) != 0)
+        return pt->error;
+    if (pt->lazy_details && proctree_read_details(pt) != 0)
+        return pt->error;
+    return proctree_sort(pt);
+}
+
+int proctree_print(proctree_t *pt)
+{
+    pt->error = 0;
+    pt->out.error = 0;
+    for (int i = 0; i < pt->process_count; i++)
+    {
+        if (proctree_is_selected(pt, pt->process_list[i]))
+            print_process_tree(pt, pt->process_list[i], 1, -1, 1, 1);
+    }
+    return pt->error ? pt->error : pt->out.error;
+}
+
+void proctree_free(proctree_t *pt)
+{
+    pthread_mutex_lock(&pt->pool_lock);
+    pt->stopping = 1;
+    pthread_cond_broadcast(&pt->scan_start);
+    pthread_mutex_unlock(&pt->pool_lock);
+    for (int i = 1; i < pt->worker_count; i++)
+        pthread_join(pt->workers[i].thread, NULL);
+
+    for (int i = 0; i < MAX_SCAN_THREADS; i++)
+    {
+        arena_free(&pt->workers[i].arena);
+        free(pt->workers[i].names.table);
+        free(pt->workers[i].nodes);
+        free(pt->workers[i].tids);
+    }
+    arena_free(&pt->node_arena);
+    free(pt->name_set.table);
+    free(pt->process_list);
+    free(pt->pid_table);
+    free(pt->child_list);
+    free(pt->order);
+    free(pt->sort_buffer);
+    free(pt->scan_pids);
+    free(pt->scan_chunks);
+    free(pt->out.data);
+    free(pt->branch_bar_recorder);
+    free(pt->bar_prefix);
+    free(pt->bar_prefix_end);
+    if (pt->proc_fd >= 0)
+        close(pt->proc_fd);
+    pthread_mutex_destroy(&pt->pool_lock);
+    pthread_cond_destroy(&pt->scan_start);
+    pthread_cond_destroy(&pt->scan_done);
+}
@@ -0,0 +1,228 @@
+#ifndef PROCTREE_H
+#define PROCTREE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// The process tree model behind pstree: scan /proc into nodes, link them into
+// a tree and render it. Everything lives in a proctree_t, so several trees
+// can coexist and one can be scanned again and again; its arenas, tables and
+// buffers are kept and reused, so once they are big enough a scan makes no
+// heap allocation at all (see allocations).
+//
+//     proctree_t tree;
+//     proctree_init(&tree);
+//     tree.show_pid = 1;
+//     for (;;)
+//     {
+//         if (proctree_scan(&tree) != 0)
+//             ... tree.error says why ...
+//         tree.out.len = 0;
+//         proctree_print(&tree);
+//         ... use tree.out.data, tree.process_list ...
+//     }
+//     proctree_free(&tree);
+//
+// The library never exits or prints an error. Calls that can fail return 0
+// or an errno value (ENOMEM, or why proc_root could not be opened), those
+// returning a pointer return NULL; either way the code is also in pt->error.
+
+#define PROC_PREFIX "/proc"
+#define MAX_NAME_LEN 256
+#define MAX_CMDLINE_LEN 1024
+#define STAT_BUF_SIZE 1024
+#define DIRENT_BUF_SIZE 65536
+#define ARENA_CHUNK_SIZE (1 << 20)
+#define SCAN_CHUNK_SIZE 64 // pids handed to a worker at a time
+#define MAX_SCAN_THREADS 64
+#define MIN_PIDS_PER_THREAD 256 // below this a thread costs more than it saves
+#define OUTPUT_FLUSH_SIZE (1 << 20)
+
+typedef struct proctree proctree_t;
+
+typedef struct process_node
+{
+    int pid;
+    int ppid;
+    const char *name; // Process name, interned; threads are "{name}"
+    char *cmdline;    // only read with -a, NULL otherwise
+    char *cmdline_buffer; // kept when the node is reused, so watch mode does
+    size_t cmdline_size;  // not leave a copy behind for every process it reads
+    int thread_count; // Number of threads, stat field 20, only read for --rollup
+    int is_thread;
+    int details_read;              // threads and cmdline, once per node
+    unsigned long long start_time; // stat field 22, tells a reused pid apart
+    int uid;                       // owner of /proc/PID, only read for pstree USER
+    unsigned long long cpu_ticks;  // --rollup: utime + stime of the process
+    unsigned long long rss_pages;  // --rollup: stat field 24
+    unsigned long long total_cpu_ticks, total_rss_pages; // --rollup: whole subtree
+    int total_threads;
+    int index;                     // position in process_list
+    struct process_node *parent;
+    struct process_node **children; // this node's range of child_list
+    int child_count;                // Number of children
+} process_node_t;
+
+// Bump allocator: nodes and strings are never freed one by one and each
+// allocation is a pointer increment. A reset keeps the chunks for reuse.
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t used, size;
+    char data[];
+} arena_chunk_t;
+
+typedef struct arena
+{
+    arena_chunk_t *head;    // every chunk, oldest first
+    arena_chunk_t *current; // the one being filled, NULL after a reset
+} arena_t;
+
+// interned names, an open-addressing set of strings kept in an arena
+typedef struct name_set
+{
+    char **table;
+    unsigned int mask;
+    int count;
+} name_set_t;
+
+// /proc is read by a pool of workers, each with its own arena, name set and
+// node list, so they never share anything but the pid list
+typedef struct scan_worker
+{
+    proctree_t *pt;
+    arena_t arena;
+    name_set_t names;
+    struct process_node **nodes;
+    int node_count, node_capacity;
+    int *tids; // task directory listing, reused
+    int tid_capacity;
+    struct process_node *free_nodes; // watch mode: nodes of exited processes
+    unsigned int generation;         // last scan this pool thread took part in
+    pthread_t thread;
+} scan_worker_t;
+
+// what one chunk of the pid list produced, for merging in pid list order
+typedef struct scan_chunk
+{
+    scan_worker_t *worker;
+    int first, count; // range of worker->nodes
+} scan_chunk_t;
+
+// The tree is assembled in one growable buffer and written with few large
+// write() calls; fd is -1 to keep a whole frame in memory (watch mode).
+typedef struct output
+{
+    char *data;
+    size_t len, capacity;
+    int fd;
+    int error; // errno of a failed write, ENOMEM if it could not grow; 0 until then
+    unsigned long long allocations; // times the buffer grew
+} output_t;
+
+struct proctree
+{
+    // options, set between proctree_init() and the first scan
+    char *proc_root; // --proc=DIR reads a saved or generated tree
+    int scan_threads; // 0 picks one per CPU, up to 8
+    int show_threads;
+    int use_thread_names;
+    int show_pid;
+    int show_compact;
+    int show_cmdline;
+    int sort_by_pid;
+    int align_mode;
+    char **branch_chars;
+    int root_pid;     // pstree PID
+    int filter_uid;   // pstree USER, -1 for none
+    int lazy_details; // threads and cmdlines are read for the printed subtrees only
+    int show_rollup;
+    size_t node_data_size; // caller's bytes after every node, see proctree_node_data()
+
+    int proc_fd; // every /proc path is opened relative to this
+
+    // every process and thread in scan order, plus an open-addressing pid index
+    // into it; child_list holds every node's children as consecutive ranges
+    arena_t node_arena;
+    name_set_t name_set;
+    process_node_t **process_list;
+    int process_count, process_capacity;
+    process_node_t **pid_table;
+    unsigned int pid_table_mask;
+    process_node_t **child_list;
+    int child_capacity;
+    process_node_t **order; // breadth-first order for rollups, stack for details
+    int order_capacity;
+    process_node_t **sort_buffer; // merge sort scratch
+    int sort_capacity;
+
+    int *scan_pids;
+    int scan_pid_count, scan_pid_capacity;
+    scan_chunk_t *scan_chunks;
+    int scan_chunk_count, scan_chunk_capacity;
+    int next_scan_chunk; // claimed with an atomic increment
+
+    // worker 0 is the scanning thread, the others are started by the first
+    // scan and then wait for the next one
+    scan_worker_t workers[MAX_SCAN_THREADS];
+    int worker_count;
+    int workers_running;
+    unsigned int scan_generation;
+    int stopping;
+    pthread_mutex_t pool_lock;
+    pthread_cond_t scan_start, scan_done;
+
+    output_t out;
+
+    // Per output column: does it hold a bar, and the bytes of every column up
+    // to it rendered once, so each line's indentation is a single copy.
+    // Columns from bar_prefix_valid on have changed since they were rendered.
+    int *branch_bar_recorder;
+    int bar_columns;
+    char *bar_prefix;
+    size_t *bar_prefix_end;
+    int bar_prefix_valid;
+
+    long page_size, ticks_per_second;
+    unsigned long long allocations; // heap allocations made, out's excluded
+    int error; // the last failure, cleared by proctree_read() and proctree_print()
+};
+
+extern char *proctree_branch_chars_default[];
+extern char *proctree_branch_chars_ascii[];
+
+void proctree_init(proctree_t *pt);
+void proctree_free(proctree_t *pt);
+int proctree_scan(proctree_t *pt);  // read, build, details when lazy, sort
+int proctree_print(proctree_t *pt); // the selected trees as text, into pt->out
+
+// the steps of proctree_scan(), for callers that time or patch them
+int proctree_read(proctree_t *pt); // also forgets the previous scan
+int proctree_build(proctree_t *pt);
+int proctree_read_details(proctree_t *pt);
+int proctree_sort(proctree_t *pt);
+int proctree_is_selected(proctree_t *pt, process_node_t *node); // a root proctree_print() prints
+
+// Patching a tree between builds (watch mode, replays): read processes into
+// a worker, add them, remove the ones that went away, then build again.
+process_node_t *proctree_find(proctree_t *pt, int pid);
+process_node_t *proctree_read_process(scan_worker_t *w, int pid); // NULL if it is gone, or pt->error
+int proctree_read_threads(scan_worker_t *w, process_node_t *node);
+int proctree_reread(proctree_t *pt, process_node_t *node);
+int proctree_add_node(proctree_t *pt, process_node_t *node);
+process_node_t *proctree_add_process(proctree_t *pt, int pid, int ppid, const char *name);
+void proctree_remove(proctree_t *pt, process_node_t *node);
+void proctree_recycle(scan_worker_t *w, process_node_t *node); // after the next build
+int proctree_is_listed(proctree_t *pt, process_node_t *node);    // not removed since it was added
+void *proctree_node_data(process_node_t *node); // node_data_size bytes, zeroed for a new node
+int proctree_list_pids(proctree_t *pt, int **pids, int *capacity); // -1 if *pids could not grow
+
+const char *proctree_intern(proctree_t *pt, const char *name);
+unsigned int proctree_name_slot(proctree_t *pt, const char *name);
+
+void proctree_out_flush(output_t *o);
+void proctree_out_write(output_t *o, const char *s, size_t len);
+void proctree_out_puts(output_t *o, const char *s);
+
+#endif
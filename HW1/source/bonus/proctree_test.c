@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "proctree.h"
+
+// 'make check': scans a tree written by fakeproc over and over, once for each
+// set of options pstree uses, and fails if any scan or print after the first
+// makes a heap allocation. malloc(), calloc() and realloc() are wrapped here,
+// so an allocation counts whether the library or libc made it. It then checks
+// that pstree USER prints a subtree of USER nested under another user once.
+//     proctree_test DIR
+
+#define WARM_ROUNDS 3
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+unsigned long long heap_allocations = 0; // scan workers allocate too
+
+void *malloc(size_t size)
+{
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(p, size);
+}
+
+typedef struct test_case
+{
+    const char *name;
+    void (*setup)(proctree_t *pt);
+} test_case_t;
+
+void setup_default(proctree_t *pt)
+{
+    (void)pt;
+}
+
+void setup_cmdline(proctree_t *pt) // pstree -pa
+{
+    pt->show_pid = 1;
+    pt->show_cmdline = 1;
+    pt->align_mode = 0;
+}
+
+void setup_subtree(proctree_t *pt) // pstree -a 5: details read lazily
+{
+    pt->root_pid = 5;
+    pt->lazy_details = 1;
+    pt->show_cmdline = 1;
+    pt->align_mode = 0;
+}
+
+void setup_user(proctree_t *pt) // pstree USER, as the owner of the fake tree
+{
+    pt->filter_uid = getuid();
+    pt->lazy_details = 1;
+}
+
+void setup_rollup(proctree_t *pt) // pstree -t --rollup
+{
+    pt->use_thread_names = 1;
+    pt->show_rollup = 1;
+}
+
+test_case_t test_cases[] = {
+    {"default", setup_default}, {"-pa", setup_cmdline}, {"-a 5", setup_subtree},
+    {"USER", setup_user},       {"-t --rollup", setup_rollup},
+};
+#define TEST_CASE_COUNT ((int)(sizeof(test_cases) / sizeof(test_cases[0])))
+
+// scan and print once, returning the heap allocations made
+unsigned long long scan_round(proctree_t *pt, const char *name)
+{
+    unsigned long long before = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED);
+    int err = proctree_scan(pt);
+    pt->out.len = 0;
+    if (err == 0)
+        err = proctree_print(pt);
+    if (err != 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", name, pt->proc_root, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    return __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED) - before;
+}
+
+// times "(pid)" occurs in the printed trees
+int count_pid(proctree_t *pt, int pid)
+{
+    char label[32];
+    int count = 0;
+    snprintf(label, sizeof(label), "(%d)", pid);
+    for (const char *p = pt->out.data; (p = strstr(p, label)) != NULL; p++)
+        count++;
+    return count;
+}
+
+// pstree -p USER where pid 2, a child of pid 1, belongs to another user: the
+// subtrees under pid 2 belong to USER again, yet pid 1's tree already has them.
+// The uid is set after the lazy scan, so no chown (and no root) is needed.
+int test_nested_user(const char *dir)
+{
+    proctree_t tree;
+    proctree_init(&tree);
+    tree.proc_root = dir;
+    tree.out.fd = -1;
+    tree.show_pid = 1;
+    tree.show_compact = 0;
+    tree.show_threads = 1;
+    tree.filter_uid = getuid();
+    tree.lazy_details = 1;
+
+    int err = proctree_read(&tree);
+    if (err == 0)
+        err = proctree_build(&tree);
+    process_node_t *other = proctree_find(&tree, 2);
+    if (err == 0 && other == NULL)
+        err = ENOENT;
+    if (err == 0)
+    {
+        other->uid = tree.filter_uid + 1;
+        err = proctree_read_details(&tree);
+    }
+    if (err == 0)
+        err = proctree_sort(&tree);
+    if (err == 0)
+        err = proctree_print(&tree);
+    if (err == 0)
+    {
+        proctree_out_write(&tree.out, "", 1); // for strstr()
+        err = tree.out.error;
+    }
+    if (err != 0)
+    {
+        fprintf(stderr, "nested USER: %s: %s\n", dir, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < tree.process_count; i++)
+    {
+        int count = count_pid(&tree, tree.process_list[i]->pid);
+        if (count != 1)
+        {
+            fprintf(stderr, "nested USER: pid %d printed %d times\n", tree.process_list[i]->pid, count);
+            failed = 1;
+            break;
+        }
+    }
+    if (!failed)
+        printf("%-12s %d tasks printed once each\n", "nested USER", tree.process_count);
+    proctree_free(&tree);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s DIR\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < TEST_CASE_COUNT; i++)
+    {
+        proctree_t tree;
+        proctree_init(&tree);
+        tree.proc_root = argv[1];
+        tree.out.fd = -1;
+        test_cases[i].setup(&tree);
+
+        unsigned long long warm_up = scan_round(&tree, test_cases[i].name);
+        printf("%-12s %llu allocations to warm up, then", test_cases[i].name, warm_up);
+        for (int r = 0; r < WARM_ROUNDS; r++)
+        {
+            unsigned long long allocations = scan_round(&tree, test_cases[i].name);
+            printf(" %llu", allocations);
+            if (allocations != 0)
+                failed = 1;
+        }
+        printf(" (%d tasks)\n", tree.process_count);
+        proctree_free(&tree);
+    }
+    if (failed)
+        fprintf(stderr, "%s: a warm scan allocated\n", argv[0]);
+
+    if (test_nested_user(argv[1]))
+        failed = 1;
+    if (failed)
+        return EXIT_FAILURE;
+    return 0;
+}
@@ -1,512 +1,1393 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pwd.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "proctree.h"
+
+#define WATCH_MAX_EVENTS 256
+#define PROC_EVENTS_BUF_SIZE 65536
+#define HISTORY_KEYFRAME_MS 600000 // a full snapshot every 10 minutes
+#define HISTORY_MAGIC "PSTH0001"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+proctree_t tree; // scanned, built and printed by proctree.c
+
+// watch mode keeps the tree and patches it with what changed
+int watch_interval_ms = 0;
+int watch_epfd = -1;
+int watch_live = 0;        // watching this host's /proc, not a --proc tree
+int proc_events_fd = -1;   // kernel process events, -1 when not permitted
+int proc_events_lost = 0;  // the socket overflowed, so every process is re-read
+int *changed_pids = NULL;  // exec'd, renamed, or started or lost a thread
+int changed_count = 0, changed_capacity = 0;
+unsigned int watch_generation = 0;
+scan_worker_t watch_worker;                 // reads new processes, serially
+process_node_t **exited_nodes = NULL;       // pidfd fired since the last refresh
+int exited_count = 0, exited_capacity = 0;
+process_node_t **removed_nodes = NULL;      // reusable once the tree is rebuilt
+int removed_count = 0, removed_capacity = 0;
+process_node_t **reread_nodes = NULL;       // orphans and resync candidates
+int reread_count = 0, reread_capacity = 0;
+
+// pstree's own state for every node, kept by the library right after it
+typedef struct node_state
+{
+    int pidfd;         // watch mode: readable once the process exits
+    unsigned int seen; // watch mode: last refresh that listed it
+    int recorded;      // --record: logged, with the values below
+    int recorded_ppid;
+    const char *recorded_name;
+} node_state_t;
+
+output_t last_frame = {.fd = -1}; // watch mode: what is on screen
+output_t screen = {.fd = STDOUT_FILENO};
+int frame_drawn = 0;
+
+// --record appends frames to an mmappable log: the file starts with
+// HISTORY_MAGIC and every frame is this header, 8-byte aligned, followed by
+// size bytes of varint events. A keyframe starts from an empty tree.
+typedef struct history_frame
+{
+    unsigned int size;
+    unsigned int flags;
+    long long time_ms;
+    long long keyframe; // file offset of the keyframe this frame builds on
+} history_frame_t;
 
-#define PROC_PREFIX "/proc"
-#define MAX_PROCESSES 100005
-#define MAX_CHILDREN 100
-#define MAX_THREADS 100
-#define MAX_NAME_LEN 256
+enum
+{
+    HISTORY_KEYFRAME = 1
+};
 
-typedef struct process_node
+// events: a varint type, then its varint fields
+enum
 {
-    int pid;
-    int ppid;
-    char name[MAX_NAME_LEN + 2]; // Process name, 256 + 2 (brackets)
-    char cmdline[1024];
-    int thread_count; // Number of threads
-    struct process_node *children[MAX_CHILDREN];
-    int child_count; // Number of children
-} process_node_t;
+    HISTORY_NAME = 1, // length bytes: the next name index
+    HISTORY_FORK,     // pid ppid name_index
+    HISTORY_EXIT,     // pid
+    HISTORY_RENAME,   // pid name_index
+    HISTORY_REPARENT  // pid ppid
+};
+
+// a recorded process that left the tree since the last frame
+typedef struct history_exit
+{
+    int pid, ppid;
+    unsigned long long start_time;
+    const char *name;
+} history_exit_t;
+
+char *record_path = NULL;
+int record_fd = -1;
+long long record_size = 0;     // bytes in the log, the next frame's offset
+long long record_keyframe = -1;
+long long record_keyframe_time = 0;
+output_t record_events = {.fd = -1};
+int *record_name_index = NULL; // like snapshot_name_index, reset by keyframes
+unsigned int record_name_slots = 0;
+int record_name_count = 0;
+history_exit_t *record_exits = NULL;
+int record_exit_count = 0, record_exit_capacity = 0;
+char *replay_path = NULL;
+double replay_at = 0; // unix seconds, or <= 0 for seconds before the last frame
+
+enum
+{
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_BINARY
+} output_format = FORMAT_TEXT;
+int *snapshot_name_index = NULL; // name_set slot -> string table index, -1 if unused
+unsigned int snapshot_name_slots = 0;
 
-process_node_t *process_tree[MAX_PROCESSES];
 
-int process_count = 0;
-int show_threads = 1;
-int use_thread_names = 0;
-int show_pid = 0;
-int show_compact = 1;
-int show_cmdline = 0;
-int sort_by_pid = 0;
-int align_mode = 1;
-int show_ascii_tree = 0;
-int branch_bar_recorder[1000];
+// The library returns its errors instead of exiting; pstree has nothing to
+// show without its tree, so it gives up on any of them.
+void check_tree(int err)
+{
+    if (err != 0)
+    {
+        fprintf(stderr, "pstree: %s: %s\n", replay_path ? replay_path : tree.proc_root, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
 
-char *branch_chars_default[] = {"├", "└", "│", "─", "┬"};
-char *branch_chars_ascii[] = {"|", "`", "|", "-", "+"};
-char **branch_chars = branch_chars_default;
+// an output buffer that could not grow or be written, e.g. to a full disk
+void check_output(output_t *o, const char *what)
+{
+    if (o->error != 0)
+    {
+        fprintf(stderr, "pstree: %s: %s\n", what, strerror(o->error));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* ------------------------------- snapshots -------------------------------- */
+
+node_state_t *node_state(process_node_t *node)
+{
+    return proctree_node_data(node);
+}
+
+long long wall_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
-void clean_process_name(char *name)
+void out_json_string(output_t *o, const char *s)
 {
-    if (name[0] == '(' || name[0] == '[')
+    proctree_out_write(o, "\"", 1);
+    const char *plain = s;
+    for (; *s; s++)
     {
-        name[strlen(name) - 1] = '\0';
-        memmove(name, name + 1, strlen(name));
+        unsigned char c = *s;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        proctree_out_write(o, plain, s - plain);
+        char escaped[8];
+        proctree_out_write(o, escaped, snprintf(escaped, sizeof(escaped), "\\u%04x", c));
+        plain = s + 1;
     }
+    proctree_out_write(o, plain, s - plain);
+    proctree_out_write(o, "\"", 1);
 }
 
-void read_process_cmdline(int pid, process_node_t *node)
+void print_json_tree(process_node_t *node)
 {
-    char path[MAX_NAME_LEN];
-    sprintf(path, PROC_PREFIX "/%d/cmdline", pid);
-    FILE *cmdline_file = fopen(path, "r");
-    if (cmdline_file)
+    char buf[160];
+    proctree_out_write(&tree.out, buf,
+                       snprintf(buf, sizeof(buf), "{\"pid\":%d,\"ppid\":%d,\"name\":", node->pid, node->ppid));
+    out_json_string(&tree.out, node->name);
+    if (node->is_thread)
+        proctree_out_puts(&tree.out, ",\"thread\":true");
+    if (node->cmdline != NULL)
+    {
+        proctree_out_puts(&tree.out, ",\"cmdline\":");
+        out_json_string(&tree.out, node->cmdline);
+    }
+    if (tree.show_rollup && !node->is_thread)
     {
-        size_t len = fread(node->cmdline, 1, sizeof(node->cmdline) - 1, cmdline_file);
-        fclose(cmdline_file);
+        proctree_out_write(&tree.out, buf, snprintf(buf, sizeof(buf),
+                                               ",\"threads\":%d,\"cpu_ticks\":%llu,\"rss_pages\":%llu,"
+                                               "\"total_threads\":%d,\"total_cpu_ticks\":%llu,\"total_rss_pages\":%llu",
+                                               node->thread_count, node->cpu_ticks, node->rss_pages,
+                                               node->total_threads, node->total_cpu_ticks, node->total_rss_pages));
+    }
+    proctree_out_puts(&tree.out, ",\"children\":[");
+    for (int i = 0; i < node->child_count; i++)
+    {
+        if (i > 0)
+            proctree_out_write(&tree.out, ",", 1);
+        print_json_tree(node->children[i]);
+    }
+    proctree_out_puts(&tree.out, "]}");
+}
 
-        if (len > 0)
-        {
-            node->cmdline[len] = '\0';
-            for (size_t i = 0; i < len; i++)
-            {
-                if (node->cmdline[i] == '\0')
-                {
-                    node->cmdline[i] = ' ';
-                }
-            }
+// One line per snapshot, written as the tree is walked:
+// {"time":MS,"trees":[{"pid":1,"ppid":0,"name":"init","children":[...]}]}
+void print_json_snapshot()
+{
+    char buf[64];
+    proctree_out_write(&tree.out, buf, snprintf(buf, sizeof(buf), "{\"time\":%lld,\"trees\":[", wall_clock_ms()));
+    int first = 1;
+    for (int i = 0; i < tree.process_count; i++)
+    {
+        if (!proctree_is_selected(&tree, tree.process_list[i]))
+            continue;
+        if (!first)
+            proctree_out_write(&tree.out, ",", 1);
+        print_json_tree(tree.process_list[i]);
+        first = 0;
+    }
+    proctree_out_puts(&tree.out, "]}\n");
+}
 
-            len = strlen(node->cmdline);
-            while (len > 0 && isspace((unsigned char)node->cmdline[len - 1]))
-            {
-                node->cmdline[--len] = '\0';
-            }
+void out_varint(output_t *o, unsigned long long value)
+{
+    unsigned char buf[10];
+    int len = 0;
+    while (value >= 0x80)
+    {
+        buf[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    proctree_out_write(o, (char *)buf, len);
+}
+
+// give every name in the subtree a string table index, in first use order
+void number_names(process_node_t *node, int *count)
+{
+    unsigned int slot = proctree_name_slot(&tree, node->name);
+    if (snapshot_name_index[slot] < 0)
+        snapshot_name_index[slot] = (*count)++;
+    for (int i = 0; i < node->child_count; i++)
+        number_names(node->children[i], count);
+}
+
+void write_strings(process_node_t *node, int *written)
+{
+    int index = snapshot_name_index[proctree_name_slot(&tree, node->name)];
+    if (index == *written)
+    {
+        size_t len = strlen(node->name);
+        out_varint(&tree.out, len);
+        proctree_out_write(&tree.out, node->name, len);
+        (*written)++;
+    }
+    for (int i = 0; i < node->child_count; i++)
+        write_strings(node->children[i], written);
+}
+
+void print_binary_tree(process_node_t *node)
+{
+    int flags = node->is_thread | (node->cmdline != NULL) << 1 | (tree.show_rollup && !node->is_thread) << 2;
+    out_varint(&tree.out, node->pid);
+    out_varint(&tree.out, snapshot_name_index[proctree_name_slot(&tree, node->name)]);
+    out_varint(&tree.out, flags);
+    if (flags & 2)
+    {
+        size_t len = strlen(node->cmdline);
+        out_varint(&tree.out, len);
+        proctree_out_write(&tree.out, node->cmdline, len);
+    }
+    if (flags & 4)
+    {
+        out_varint(&tree.out, node->thread_count);
+        out_varint(&tree.out, node->cpu_ticks);
+        out_varint(&tree.out, node->rss_pages);
+    }
+    out_varint(&tree.out, node->child_count);
+    for (int i = 0; i < node->child_count; i++)
+        print_binary_tree(node->children[i]);
+}
+
+// Binary snapshot, all integers LEB128 varints:
+//   "PST1" time_ms
+//   string_count { length bytes }          names, each stored once
+//   tree_count { root_ppid node }
+//   node: pid name_index flags [cmdline_length bytes] [threads cpu_ticks rss_pages]
+//         child_count { node }
+// flags: 1 thread, 2 cmdline present, 4 usage present (--rollup)
+void print_binary_snapshot()
+{
+    if (snapshot_name_slots != tree.name_set.mask + 1)
+    {
+        snapshot_name_slots = tree.name_set.mask + 1;
+        snapshot_name_index = realloc(snapshot_name_index, snapshot_name_slots * sizeof(int));
+        if (snapshot_name_index == NULL)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
         }
-        else
+    }
+    memset(snapshot_name_index, -1, snapshot_name_slots * sizeof(int));
+
+    int string_count = 0, tree_count = 0;
+    for (int i = 0; i < tree.process_count; i++)
+    {
+        if (proctree_is_selected(&tree, tree.process_list[i]))
         {
-            strcpy(node->cmdline, "()");
+            number_names(tree.process_list[i], &string_count);
+            tree_count++;
         }
     }
-    else
+
+    proctree_out_write(&tree.out, "PST1", 4);
+    out_varint(&tree.out, wall_clock_ms());
+    out_varint(&tree.out, string_count);
+    int written = 0;
+    for (int i = 0; i < tree.process_count; i++)
+    {
+        if (proctree_is_selected(&tree, tree.process_list[i]))
+            write_strings(tree.process_list[i], &written);
+    }
+    out_varint(&tree.out, tree_count);
+    for (int i = 0; i < tree.process_count; i++)
     {
-        strcpy(node->cmdline, "()");
+        if (proctree_is_selected(&tree, tree.process_list[i]))
+        {
+            out_varint(&tree.out, tree.process_list[i]->ppid);
+            print_binary_tree(tree.process_list[i]);
+        }
     }
 }
 
-void read_process_threads(int pid, process_node_t *node)
+// 0 or an errno value, like proctree_print()
+int print_selected_trees()
 {
-    char path[MAX_NAME_LEN];
-    DIR *task_dir;
-    struct dirent *entry;
+    tree.out.error = 0;
+    if (output_format == FORMAT_JSON)
+    {
+        print_json_snapshot();
+        return tree.out.error;
+    }
+    if (output_format == FORMAT_BINARY)
+    {
+        print_binary_snapshot();
+        return tree.out.error;
+    }
 
-    sprintf(path, PROC_PREFIX "/%d/task", pid);
-    task_dir = opendir(path);
-    if (!task_dir)
-        return;
+    return proctree_print(&tree);
+}
+
+/* -------------------------------- history --------------------------------- */
 
-    while ((entry = readdir(task_dir)) != NULL)
+void history_note_exit(process_node_t *node)
+{
+    if (record_exit_count == record_exit_capacity)
     {
-        if (isdigit(entry->d_name[0]))
+        record_exit_capacity = record_exit_capacity ? record_exit_capacity * 2 : 256;
+        record_exits = realloc(record_exits, record_exit_capacity * sizeof(history_exit_t));
+        if (record_exits == NULL)
         {
-            int tid = atoi(entry->d_name);
-            if (tid != pid)
-            {
-                sprintf(path, PROC_PREFIX "/%d/task/%d/stat", pid, tid);
-                FILE *stat_file = fopen(path, "r");
-                if (stat_file)
-                {
-                    char thread_name[256];
-                    fscanf(stat_file, "%*d %s", thread_name);
-                    fclose(stat_file);
-
-                    clean_process_name(thread_name);
-
-                    process_node_t *thread_node = malloc(sizeof(process_node_t));
-                    thread_node->pid = tid;
-                    thread_node->ppid = pid;
-                    if (use_thread_names)
-                    {
-                        snprintf(thread_node->name, sizeof(thread_node->name), "{%s}", thread_name);
-                    }
-                    else
-                    {
-                        snprintf(thread_node->name, sizeof(thread_node->name), "{%s}", node->name);
-                    }
-
-                    thread_node->child_count = 0;
-                    thread_node->thread_count = 0;
-
-                    node->children[node->child_count++] = thread_node;
-                }
-            }
+            perror("realloc");
+            exit(EXIT_FAILURE);
         }
     }
-    closedir(task_dir);
+    history_exit_t *e = &record_exits[record_exit_count++];
+    e->pid = node->pid;
+    e->ppid = node_state(node)->recorded_ppid;
+    e->start_time = node->start_time;
+    e->name = node_state(node)->recorded_name;
 }
 
-void read_process_info(int pid)
+// a name's index in the current keyframe's string table, defined on first use
+int history_name(const char *name)
 {
-    char path[MAX_NAME_LEN], name[MAX_NAME_LEN];
-    FILE *stat_file;
-    int ppid;
+    unsigned int slot = proctree_name_slot(&tree, name);
+    if (record_name_index[slot] < 0)
+    {
+        size_t len = strlen(name);
+        out_varint(&record_events, HISTORY_NAME);
+        out_varint(&record_events, len);
+        proctree_out_write(&record_events, name, len);
+        record_name_index[slot] = record_name_count++;
+    }
+    return record_name_index[slot];
+}
 
-    sprintf(path, PROC_PREFIX "/%d/stat", pid);
-    stat_file = fopen(path, "r");
-    if (!stat_file)
-        return;
+void history_event(int type, int pid, long long value)
+{
+    out_varint(&record_events, type);
+    out_varint(&record_events, pid);
+    if (type != HISTORY_EXIT)
+        out_varint(&record_events, value);
+}
 
-    fscanf(stat_file, "%d %s %*c %d", &pid, name, &ppid);
-    fclose(stat_file);
+// log what changed in a process since it was last written
+void history_update(process_node_t *node)
+{
+    node_state_t *state = node_state(node);
+    if (!state->recorded)
+    {
+        int name = history_name(node->name);
+        out_varint(&record_events, HISTORY_FORK);
+        out_varint(&record_events, node->pid);
+        out_varint(&record_events, node->ppid);
+        out_varint(&record_events, name);
+    }
+    else
+    {
+        if (node->name != state->recorded_name)
+            history_event(HISTORY_RENAME, node->pid, history_name(node->name));
+        if (node->ppid != state->recorded_ppid)
+            history_event(HISTORY_REPARENT, node->pid, node->ppid);
+    }
+    state->recorded = 1;
+    state->recorded_ppid = node->ppid;
+    state->recorded_name = node->name;
+}
 
-    clean_process_name(name);
+int compare_exit_pid(const void *a, const void *b)
+{
+    return ((const history_exit_t *)a)->pid - ((const history_exit_t *)b)->pid;
+}
 
-    process_node_t *node = malloc(sizeof(process_node_t));
-    node->pid = pid;
-    node->ppid = ppid;
-    strncpy(node->name, name, sizeof(node->name));
-    node->thread_count = 0;
-    node->child_count = 0;
-    node->cmdline[0] = '\0';
+// One frame per refresh, holding only forks, exits, renames and reparenting.
+// Watch mode re-reads a process whose name changed as a new node, so an exit
+// followed by a node with the same pid and start time is logged as a rename.
+void history_record()
+{
+    long long now = wall_clock_ms();
+    int keyframe = record_keyframe < 0 || now - record_keyframe_time >= HISTORY_KEYFRAME_MS ||
+                   record_name_slots != tree.name_set.mask + 1; // name slots moved
 
-    process_tree[pid] = node;
-    process_count++;
+    record_events.len = 0;
+    if (keyframe)
+    {
+        if (record_name_slots != tree.name_set.mask + 1)
+        {
+            record_name_slots = tree.name_set.mask + 1;
+            record_name_index = realloc(record_name_index, record_name_slots * sizeof(int));
+            if (record_name_index == NULL)
+            {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memset(record_name_index, -1, record_name_slots * sizeof(int));
+        record_name_count = 0;
+        for (int i = 0; i < tree.process_count; i++)
+        {
+            node_state(tree.process_list[i])->recorded = 0;
+        }
+    }
+    else
+    {
+        qsort(record_exits, record_exit_count, sizeof(history_exit_t), compare_exit_pid);
+        for (int i = 0; i < record_exit_count; i++)
+        {
+            history_exit_t *e = &record_exits[i];
+            process_node_t *node = proctree_find(&tree, e->pid);
+            if (i + 1 < record_exit_count && record_exits[i + 1].pid == e->pid)
+                node = NULL; // reused more than once, the last exit decides
+            node_state_t *state = node != NULL ? node_state(node) : NULL;
+            if (node != NULL && !state->recorded && !node->is_thread && node->start_time == e->start_time)
+            {
+                state->recorded = 1; // the same process, read again
+                state->recorded_ppid = e->ppid;
+                state->recorded_name = e->name;
+            }
+            else
+                history_event(HISTORY_EXIT, e->pid, 0);
+        }
+    }
+    record_exit_count = 0;
 
-    if (show_threads)
+    for (int i = 0; i < tree.process_count; i++)
     {
-        read_process_threads(pid, node);
+        if (!tree.process_list[i]->is_thread)
+            history_update(tree.process_list[i]);
     }
+    if (record_events.len == 0 && !keyframe)
+        return; // nothing happened, the previous frame still holds
 
-    if (show_cmdline)
+    if (keyframe)
+    {
+        record_keyframe = record_size;
+        record_keyframe_time = now;
+    }
+    history_frame_t frame = {
+        .size = record_events.len,
+        .flags = keyframe ? HISTORY_KEYFRAME : 0,
+        .time_ms = now,
+        .keyframe = record_keyframe,
+    };
+    while (record_events.len % 8 != 0)
+        proctree_out_write(&record_events, "", 1);
+    check_output(&record_events, record_path);
+    // one write, so that a replay running meanwhile sees no header without its events
+    struct iovec parts[2] = {{&frame, sizeof(frame)}, {record_events.data, record_events.len}};
+    if (writev(record_fd, parts, 2) != (ssize_t)(sizeof(frame) + record_events.len))
     {
-        read_process_cmdline(pid, node);
+        perror(record_path);
+        exit(EXIT_FAILURE);
     }
+    record_size += sizeof(frame) + record_events.len;
 }
 
-int compare_by_name(const void *a, const void *b)
+// offset of the frame that follows the one at offset
+long long history_next(const history_frame_t *frame, long long offset)
 {
-    process_node_t *node_a = *(process_node_t **)a;
-    process_node_t *node_b = *(process_node_t **)b;
-    return strcmp(node_a->name, node_b->name);
+    return offset + (long long)sizeof(history_frame_t) + (((long long)frame->size + 7) & ~7LL);
 }
 
-int compare_by_pid(const void *a, const void *b)
+void history_open()
 {
-    process_node_t *node_a = *(process_node_t **)a;
-    process_node_t *node_b = *(process_node_t **)b;
-    return node_a->pid - node_b->pid;
+    record_fd = open(record_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (record_fd < 0)
+    {
+        perror(record_path);
+        exit(EXIT_FAILURE);
+    }
+    record_size = lseek(record_fd, 0, SEEK_END);
+    if (record_size == 0)
+    {
+        if (write(record_fd, HISTORY_MAGIC, 8) != 8)
+        {
+            perror(record_path);
+            exit(EXIT_FAILURE);
+        }
+        record_size = 8;
+        return;
+    }
+
+    char magic[8];
+    if (pread(record_fd, magic, 8, 0) != 8 || memcmp(magic, HISTORY_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "pstree: %s is not a pstree history\n", record_path);
+        exit(EXIT_FAILURE);
+    }
+    // a recorder that died while writing left a torn frame; new frames go
+    // after the last complete one instead
+    long long end = 8;
+    history_frame_t frame;
+    while (end < record_size && pread(record_fd, &frame, sizeof(frame), end) == sizeof(frame) &&
+           history_next(&frame, end) <= record_size)
+        end = history_next(&frame, end);
+    if (end < record_size && ftruncate(record_fd, end) < 0)
+    {
+        perror(record_path);
+        exit(EXIT_FAILURE);
+    }
+    record_size = end;
 }
 
-void sort_children(process_node_t *node)
+unsigned long long read_varint(const unsigned char **p, const unsigned char *end)
 {
-    if (node->child_count > 1)
+    unsigned long long value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7)
     {
-        qsort(
-            node->children,
-            node->child_count,
-            sizeof(process_node_t *),
-            sort_by_pid ? compare_by_pid : compare_by_name);
+        unsigned char byte = *(*p)++;
+        value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+            break;
     }
+    return value;
 }
 
-void read_all_processes()
+// apply one frame's events to the process list
+void history_apply(const unsigned char *p, const unsigned char *end, const char ***names, int *name_count,
+                   int *name_capacity)
 {
-    DIR *proc_dir;
-    struct dirent *entry;
+    char name[MAX_NAME_LEN];
+    // for an index past the string table; interned like every other name
+    const char *unknown = proctree_intern(&tree, "?");
+    if (unknown == NULL)
+        check_tree(tree.error);
+    while (p < end)
+    {
+        int type = read_varint(&p, end);
+        if (type == 0)
+            break; // padding
+        if (type == HISTORY_NAME)
+        {
+            size_t len = read_varint(&p, end);
+            if (len > (size_t)(end - p))
+                break;
+            if (*name_count == *name_capacity)
+            {
+                *name_capacity = *name_capacity ? *name_capacity * 2 : 256;
+                *names = realloc(*names, *name_capacity * sizeof(char *));
+                if (*names == NULL)
+                {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            snprintf(name, sizeof(name), "%.*s", (int)len, (const char *)p);
+            const char *interned = proctree_intern(&tree, name);
+            if (interned == NULL)
+                check_tree(tree.error);
+            (*names)[(*name_count)++] = interned;
+            p += len;
+            continue;
+        }
+
+        int pid = read_varint(&p, end);
+        unsigned long long value = type == HISTORY_EXIT ? 0 : read_varint(&p, end);
+        process_node_t *node = proctree_find(&tree, pid);
+        if (type == HISTORY_FORK)
+        {
+            unsigned long long index = read_varint(&p, end);
+            if (node != NULL)
+                proctree_remove(&tree, node);
+            const char *fork_name = index < (unsigned long long)*name_count ? (*names)[index] : unknown;
+            if (proctree_add_process(&tree, pid, value, fork_name) == NULL)
+                check_tree(tree.error);
+        }
+        else if (node == NULL)
+            continue;
+        else if (type == HISTORY_EXIT)
+            proctree_remove(&tree, node);
+        else if (type == HISTORY_RENAME)
+            node->name = value < (unsigned long long)*name_count ? (*names)[value] : unknown;
+        else if (type == HISTORY_REPARENT)
+            node->ppid = value;
+    }
+}
+
+// Rebuild the tree as it was at replay_at: find the last frame at or before
+// it, then apply the frames from its keyframe up to it.
+void history_reject(long long offset, const char *problem)
+{
+    fprintf(stderr, "pstree: %s: the frame at offset %lld %s\n", replay_path, offset, problem);
+    exit(EXIT_FAILURE);
+}
 
-    proc_dir = opendir(PROC_PREFIX);
-    if (!proc_dir)
+void history_replay()
+{
+    int fd = open(replay_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(replay_path);
+        exit(EXIT_FAILURE);
+    }
+    const unsigned char *data = NULL;
+    if (st.st_size >= 8)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == NULL || data == MAP_FAILED || memcmp(data, HISTORY_MAGIC, 8) != 0)
     {
-        perror("Cannot open /proc");
+        fprintf(stderr, "pstree: %s is not a pstree history\n", replay_path);
         exit(EXIT_FAILURE);
     }
 
-    while ((entry = readdir(proc_dir)) != NULL)
+    // Frame headers chain through their sizes, and each frame names the last
+    // keyframe at or before it. Anything else is a damaged file.
+    long long last = -1, target = -1, keyframe = -1;
+    long long at_ms = replay_at * 1000;
+    for (long long offset = 8; offset < st.st_size;)
+    {
+        const history_frame_t *frame = (const history_frame_t *)(data + offset);
+        if (st.st_size - offset < (long long)sizeof(history_frame_t) || history_next(frame, offset) > st.st_size)
+            history_reject(offset, "runs past the end of the file");
+        if (frame->flags & HISTORY_KEYFRAME)
+            keyframe = offset;
+        if (frame->keyframe != keyframe)
+            history_reject(offset, "does not point at its keyframe");
+        if (replay_at > 0 && frame->time_ms <= at_ms)
+            target = offset;
+        last = offset;
+        offset = history_next(frame, offset);
+    }
+    if (replay_at <= 0 && last >= 0)
     {
-        if (isdigit(entry->d_name[0]))
+        at_ms = ((const history_frame_t *)(data + last))->time_ms + replay_at * 1000;
+        for (long long offset = 8; offset <= last;)
         {
-            int pid = atoi(entry->d_name);
-            read_process_info(pid);
+            const history_frame_t *frame = (const history_frame_t *)(data + offset);
+            if (frame->time_ms <= at_ms)
+                target = offset;
+            offset = history_next(frame, offset);
         }
     }
-    closedir(proc_dir);
+    if (target < 0)
+    {
+        fprintf(stderr, "pstree: %s has no snapshot that early\n", replay_path);
+        exit(EXIT_FAILURE);
+    }
+
+    const char **names = NULL;
+    int name_count = 0, name_capacity = 0;
+    long long offset = ((const history_frame_t *)(data + target))->keyframe;
+    while (offset <= target)
+    {
+        const history_frame_t *frame = (const history_frame_t *)(data + offset);
+        const unsigned char *events = (const unsigned char *)(frame + 1);
+        if (frame->flags & HISTORY_KEYFRAME)
+            name_count = 0;
+        history_apply(events, events + frame->size, &names, &name_count, &name_capacity);
+        offset = history_next(frame, offset);
+    }
+    free(names);
+    munmap((void *)data, st.st_size);
 }
 
-void build_process_tree()
+/* ------------------------------- watch mode ------------------------------- */
+
+void push_node(process_node_t ***list, int *count, int *capacity, process_node_t *node)
 {
-    for (int i = 0; i < MAX_PROCESSES; i++)
+    if (*count == *capacity)
     {
-        if (process_tree[i] != NULL)
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        *list = realloc(*list, *capacity * sizeof(process_node_t *));
+        if (*list == NULL)
         {
-            int ppid = process_tree[i]->ppid;
-            if (ppid > 0 && process_tree[ppid] != NULL)
-            {
-                process_tree[ppid]->children[process_tree[ppid]->child_count++] = process_tree[i];
-            }
+            perror("realloc");
+            exit(EXIT_FAILURE);
         }
     }
+    (*list)[(*count)++] = node;
+}
 
-    for (int i = 0; i < MAX_PROCESSES; i++)
+void note_changed_pid(int pid)
+{
+    if (changed_count == changed_capacity)
     {
-        if (process_tree[i] != NULL)
+        changed_capacity = changed_capacity ? changed_capacity * 2 : 1024;
+        changed_pids = realloc(changed_pids, changed_capacity * sizeof(int));
+        if (changed_pids == NULL)
         {
-            sort_children(process_tree[i]);
+            perror("realloc");
+            exit(EXIT_FAILURE);
         }
     }
+    changed_pids[changed_count++] = pid;
 }
 
-int count_same_name_children(process_node_t *node, int start_idx, char *name)
+// Drain the process events socket into changed_pids. Returns the error of a
+// subscription acknowledgement if one was read, -1 otherwise.
+int read_proc_events()
 {
-    int count = 0;
-    for (int i = start_idx; i < node->child_count; i++)
+    static char buf[PROC_EVENTS_BUF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    int ack = -1;
+    ssize_t len;
+    while ((len = recv(proc_events_fd, buf, sizeof(buf), MSG_DONTWAIT)) != 0)
     {
-        if (strcmp(node->children[i]->name, name) == 0 && node->children[i]->child_count == 0)
+        if (len < 0)
         {
-            count++;
+            if (errno != ENOBUFS)
+                break;
+            proc_events_lost = 1; // events were dropped, nothing tells which
+            continue;
+        }
+        for (struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len))
+        {
+            // the event follows a 20-byte connector header, so it is not
+            // aligned for its 64-bit timestamp and is copied out first
+            struct cn_msg *msg = NLMSG_DATA(h);
+            struct proc_event event = {0}, *ev = &event;
+            memcpy(&event, msg->data, msg->len < sizeof(event) ? msg->len : sizeof(event));
+            switch (ev->what)
+            {
+            case PROC_EVENT_NONE:
+                ack = ev->event_data.ack.err;
+                break;
+            case PROC_EVENT_FORK:
+                // a new thread changes its process; a new process is listed
+                // anyway, but its pid may belong to an exit that was missed
+                if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+                    note_changed_pid(ev->event_data.fork.child_pid);
+                else if (tree.show_threads)
+                    note_changed_pid(ev->event_data.fork.child_tgid);
+                break;
+            case PROC_EVENT_EXEC:
+                note_changed_pid(ev->event_data.exec.process_tgid);
+                break;
+            case PROC_EVENT_COMM:
+                note_changed_pid(ev->event_data.comm.process_tgid);
+                break;
+            case PROC_EVENT_EXIT:
+                if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid || tree.show_threads)
+                    note_changed_pid(ev->event_data.exit.process_tgid);
+                break;
+            default:
+                break;
+            }
         }
     }
-    return count;
+    return ack;
 }
 
-void print_bar(int is_print)
+// Subscribe to the kernel's process events connector, which reports every
+// fork, exec, rename and exit as it happens. It needs CAP_NET_ADMIN; without
+// it every refresh has to re-read every process.
+void open_proc_events()
 {
-    if (!align_mode)
-        printf("  ");
+    proc_events_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC};
+    if (proc_events_fd < 0 || bind(proc_events_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto fail;
 
-    if (is_print)
-        printf(branch_chars[2]);
-    else
-        printf(" ");
+    struct
+    {
+        struct nlmsghdr header;
+        struct cn_msg msg;
+        enum proc_cn_mcast_op op;
+    } __attribute__((packed)) request = {
+        .header = {.nlmsg_len = sizeof(request), .nlmsg_type = NLMSG_DONE},
+        .msg = {.id = {.idx = CN_IDX_PROC, .val = CN_VAL_PROC}, .len = sizeof(enum proc_cn_mcast_op)},
+        .op = PROC_CN_MCAST_LISTEN,
+    };
+    if (send(proc_events_fd, &request, sizeof(request), 0) != sizeof(request))
+        goto fail;
+
+    // the kernel acknowledges with the result of its permission check
+    struct pollfd pfd = {.fd = proc_events_fd, .events = POLLIN};
+    int ack = -1;
+    while (ack < 0 && poll(&pfd, 1, 1000) > 0)
+        ack = read_proc_events();
+    if (ack == 0)
+        return;
+
+fail:
+    if (proc_events_fd >= 0)
+        close(proc_events_fd);
+    proc_events_fd = -1;
+}
 
-    if (!align_mode)
-        printf(" ");
+// Exits are reported by a pidfd per process, so a pid that is listed again
+// after its pidfd fired is a new process even if the pid was reused.
+void watch_track(process_node_t *node)
+{
+    node_state_t *state = node_state(node);
+    state->pidfd = -1;
+    if (node->is_thread || !watch_live)
+        return;
+    state->pidfd = syscall(SYS_pidfd_open, node->pid, 0);
+    if (state->pidfd < 0)
+        return; // e.g. out of descriptors: the /proc listing still sees the exit
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = node};
+    epoll_ctl(watch_epfd, EPOLL_CTL_ADD, state->pidfd, &ev);
 }
 
-void print_process_tree(process_node_t *node, int depth, int is_last_child, int is_first_child)
+// Drop a process together with its threads. Its child processes have been
+// reparented meanwhile, so their stat is read again.
+void watch_drop(process_node_t *node)
 {
-    // Print the tree structure
-    char *branch_prefix = branch_chars[0];
-    if (is_last_child == 1)
+    if (!proctree_is_listed(&tree, node))
+        return;
+    proctree_remove(&tree, node);
+    push_node(&removed_nodes, &removed_count, &removed_capacity, node);
+    node_state_t *state = node_state(node);
+    if (state->recorded)
+        history_note_exit(node);
+    if (state->pidfd >= 0)
+        close(state->pidfd); // also leaves the epoll set
+    state->pidfd = -1;
+
+    for (int i = 0; i < node->child_count; i++)
     {
-        branch_prefix = branch_chars[1];
+        process_node_t *child = node->children[i];
+        if (child->is_thread)
+            watch_drop(child);
+        else if (proctree_is_listed(&tree, child))
+            push_node(&reread_nodes, &reread_count, &reread_capacity, child);
     }
+}
 
-    if (align_mode)
+// New nodes were read into watch_worker; index them like a full scan would.
+void watch_merge_new()
+{
+    for (int i = 0; i < watch_worker.node_count; i++)
     {
-        branch_bar_recorder[depth + 1] = is_last_child ? 0 : 1;
+        process_node_t *node = watch_worker.nodes[i];
+        check_tree(proctree_add_node(&tree, node));
+        node_state(node)->seen = watch_generation;
+        watch_track(node);
     }
-    else
+    watch_worker.node_count = 0;
+}
+
+// Read stat again for a known process: follow a reparenting, and with
+// threads also re-list its threads. A pid that now belongs to another program
+// is read like a new process.
+void watch_reread(process_node_t *node, int threads)
+{
+    if (!proctree_is_listed(&tree, node))
+        return;
+    if (!proctree_reread(&tree, node))
     {
-        branch_bar_recorder[depth] = is_last_child ? 0 : 1;
+        int pid = node->pid;
+        watch_drop(node);
+        proctree_read_process(&watch_worker, pid);
+        return;
     }
 
-    if (!(align_mode && is_first_child))
-        for (int i = 0; i < depth; i++)
+    if (threads && tree.show_threads)
+    {
+        for (int i = 0; i < node->child_count; i++)
         {
-            print_bar(branch_bar_recorder[i]);
+            if (node->children[i]->is_thread)
+                watch_drop(node->children[i]);
         }
+        check_tree(proctree_read_threads(&watch_worker, node));
+    }
+}
 
-    char *name_p = node->name;
-    char name[260] = "";
-
-    if (node->cmdline[0] != '\0')
+// Rows are redrawn only where the new frame (in tree.out) differs from the last.
+void watch_draw()
+{
+    char *frame = tree.out.data;
+    size_t len = tree.out.len;
+    if (!frame_drawn)
     {
-        // Remove the absolute path of the command
-        char *cmdline = node->cmdline;
-        // Get the last space position
-        char *first_name_occur = strstr(cmdline, " ");
-        char *last_slash = NULL;
-
-        if (first_name_occur)
+        proctree_out_puts(&screen, "\033[H\033[2J");
+        proctree_out_write(&screen, frame, len);
+        frame_drawn = 1;
+    }
+    else
+    {
+        char *old = last_frame.data, *old_end = last_frame.data + last_frame.len;
+        char *new = frame, *new_end = frame + len;
+        for (int row = 1; new < new_end; row++)
         {
-            // find the last slash before the first space
-            last_slash = first_name_occur;
-            while (last_slash > cmdline && *last_slash != '/')
-            {
-                last_slash--;
-            }
+            char *new_eol = memchr(new, '\n', new_end - new);
+            new_eol = new_eol ? new_eol + 1 : new_end;
+            char *old_eol = old < old_end ? memchr(old, '\n', old_end - old) : NULL;
+            old_eol = old_eol ? old_eol + 1 : old_end;
 
-            if (*last_slash == '/')
-            {
-                last_slash++; // skip the slash
-            }
-            else
+            if (new_eol - new != old_eol - old || memcmp(new, old, new_eol - new) != 0)
             {
-                last_slash = cmdline;
+                char move[32];
+                proctree_out_write(&screen, move, snprintf(move, sizeof(move), "\033[%d;1H\033[K", row));
+                proctree_out_write(&screen, new, new_eol - new);
             }
-
-            // copy the name
-            name_p = last_slash;
-            strncpy(name, name_p, sizeof(name) - 1);
-            name[sizeof(name) - 1] = '\0';
-        }
-        else
-        {
-            name_p = cmdline;
-            strncpy(name, name_p, sizeof(name) - 1);
-            name[sizeof(name) - 1] = '\0';
+            new = new_eol;
+            old = old_eol;
         }
+        if (old < old_end)
+            proctree_out_puts(&screen, "\033[J"); // the tree got shorter
     }
-    else
+    proctree_out_flush(&screen);
+    check_output(&screen, "stdout");
+
+    // keep this frame for the next comparison, reuse the other buffer
+    output_t shown = tree.out;
+    tree.out = last_frame;
+    last_frame = shown;
+    tree.out.len = 0;
+    tree.out.fd = -1;
+}
+
+void watch_render()
+{
+    tree.out.len = 0;
+    if (record_fd >= 0)
+    {
+        history_record();
+        return;
+    }
+    if (output_format != FORMAT_TEXT)
     {
-        // use the name if cmdline is empty
-        strncpy(name, name_p, sizeof(name) - 1);
-        name[sizeof(name) - 1] = '\0';
+        // snapshots are streamed, one per refresh
+        tree.out.fd = STDOUT_FILENO;
+        check_tree(print_selected_trees());
+        proctree_out_flush(&tree.out);
+        check_output(&tree.out, "stdout");
+        return;
     }
+    tree.out.fd = -1;
+    check_tree(print_selected_trees());
+    watch_draw();
+}
+
+int compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
 
-    if (align_mode && is_first_child)
+// One refresh: drop what exited, list /proc for pids not seen before, drop
+// pids no longer listed, and re-read the reparented processes and those the
+// process events reported as changed. Without those events (or after some
+// were lost) every process is re-read, so renames by exec, new threads and
+// reused pids show up in the next refresh either way.
+void watch_refresh(int resync)
+{
+    static int *pids = NULL;
+    static int capacity = 0;
+
+    for (int i = 0; i < exited_count; i++)
+    {
+        watch_drop(exited_nodes[i]);
+    }
+    exited_count = 0;
+
+    watch_generation++;
+    int count = proctree_list_pids(&tree, &pids, &capacity);
+    if (count < 0)
+        check_tree(tree.error);
+    for (int i = 0; i < count; i++)
     {
-        branch_prefix = branch_chars[4];
-        if (is_last_child)
+        process_node_t *node = proctree_find(&tree, pids[i]);
+        if (node != NULL && node->is_thread)
         {
-            branch_prefix = branch_chars[3];
+            watch_drop(node); // a stale thread whose tid came back as a process
+            node = NULL;
         }
+        if (node != NULL)
+            node_state(node)->seen = watch_generation;
+        else
+            proctree_read_process(&watch_worker, pids[i]);
+    }
+    for (int i = tree.process_count - 1; i >= 0; i--)
+    {
+        if (i >= tree.process_count)
+            continue;
+        process_node_t *node = tree.process_list[i];
+        if (!node->is_thread && node_state(node)->seen != watch_generation)
+            watch_drop(node);
     }
-    char *sep = branch_chars[3];
 
-    char depth_prefix[20] = "";
-    int depth_prefix_len = 0;
-    // format depth prefix
-    if (depth != -1)
+    if (!resync)
     {
-        if (align_mode)
+        // a process that started many threads is still read once
+        if (changed_count > 1)
+            qsort(changed_pids, changed_count, sizeof(int), compare_int);
+        for (int i = 0; i < changed_count; i++)
         {
-            if (is_first_child)
-            {
-                snprintf(depth_prefix, sizeof(depth_prefix), "%s%s%s", sep, branch_prefix, sep);
-                depth_prefix_len = 3;
-            }
-            else
-            {
-                snprintf(depth_prefix, sizeof(depth_prefix), " %s%s", branch_prefix, sep);
-                depth_prefix_len = 3;
-            }
+            process_node_t *node = proctree_find(&tree, changed_pids[i]);
+            if ((i == 0 || changed_pids[i] != changed_pids[i - 1]) && node != NULL && !node->is_thread)
+                watch_reread(node, 1);
         }
-        else
+    }
+    changed_count = 0;
+    // no event tells when RSS or CPU time grew, so --rollup reads every stat again
+    if (resync || tree.show_rollup)
+    {
+        for (int i = 0; i < tree.process_count; i++)
         {
-            snprintf(depth_prefix, sizeof(depth_prefix), "  %s%s", branch_prefix, sep);
-            depth_prefix_len = 4;
+            if (!tree.process_list[i]->is_thread)
+                push_node(&reread_nodes, &reread_count, &reread_capacity, tree.process_list[i]);
         }
     }
-
-    char output[1024] = "";
-    if (name == NULL)
+    // watch_drop() may append orphans while this runs
+    for (int i = 0; i < reread_count; i++)
     {
-        fprintf(stderr, "Error: name is NULL\n");
-        return;
+        watch_reread(reread_nodes[i], resync);
     }
+    reread_count = 0;
 
-    // debug use
-    // for (int i = 0; i < strlen(name); i++)
-    // {
-    //     printf("%c (%d)\n", name[i], (unsigned char)name[i]);
-    // }
+    check_tree(tree.error); // a process that could not be read for want of memory
+    watch_merge_new();
+    check_tree(proctree_build(&tree));
+    check_tree(proctree_sort(&tree));
 
-    if (show_pid)
-        snprintf(output, sizeof(output), "%s(%d)", name, node->pid);
-    else
-        snprintf(output, sizeof(output), "%s", name);
+    // nothing points at the dropped nodes any more
+    for (int i = 0; i < removed_count; i++)
+    {
+        proctree_recycle(&watch_worker, removed_nodes[i]);
+    }
+    removed_count = 0;
+}
 
-    int offset = 0;
+long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
-    if (align_mode)
+void watch_processes()
+{
+    // one pidfd per process
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
     {
-        // all subnode adding depth(offset) by output length
-        if (depth != -1)
-            offset += depth_prefix_len;
-        else
-            offset += 1;
-        offset += strlen(output);
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
     }
-    else
+    watch_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (watch_epfd < 0)
     {
-        offset += 1;
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
     }
-
-    printf("%s%s", depth_prefix, output);
-
-    if (align_mode)
+    // a --proc tree has no processes behind it to get pidfds or events for
+    watch_live = strcmp(tree.proc_root, PROC_PREFIX) == 0;
+    if (watch_live)
+        open_proc_events();
+    if (proc_events_fd >= 0)
     {
-        if (node->child_count == 0)
-        {
-            printf("\n");
-        }
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &proc_events_fd};
+        epoll_ctl(watch_epfd, EPOLL_CTL_ADD, proc_events_fd, &ev);
     }
-    else
+
+    watch_generation++;
+    for (int i = 0; i < tree.process_count; i++)
     {
-        printf("\n");
+        node_state(tree.process_list[i])->seen = watch_generation;
+        watch_track(tree.process_list[i]);
     }
+    watch_render();
 
-    for (int i = 0; i < node->child_count; i++)
+    for (;;)
     {
-        int same_name_count = 1;
-
-        if (show_compact)
+        long long deadline = now_ms() + watch_interval_ms;
+        long long left;
+        while ((left = deadline - now_ms()) > 0)
         {
-            same_name_count = count_same_name_children(node, i, node->children[i]->name);
+            struct epoll_event events[WATCH_MAX_EVENTS];
+            int n = epoll_wait(watch_epfd, events, WATCH_MAX_EVENTS, left);
+            for (int i = 0; i < n; i++)
+            {
+                if (events[i].data.ptr == &proc_events_fd)
+                {
+                    read_proc_events();
+                    continue;
+                }
+                process_node_t *node = events[i].data.ptr;
+                node_state_t *state = node_state(node);
+                close(state->pidfd);
+                state->pidfd = -1;
+                push_node(&exited_nodes, &exited_count, &exited_capacity, node);
+            }
         }
+        watch_refresh(proc_events_fd < 0 || proc_events_lost);
+        proc_events_lost = 0;
+        watch_render();
+    }
+}
 
-        int fisrt_child_flag = 0;
-        if (same_name_count > 1)
-        {
-            i += same_name_count - 1; // skip same name children
+/* ------------------------------- benchmark -------------------------------- */
 
-            // update node->children[i]->name
-            char temp_name[260] = "";
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-            snprintf(temp_name, sizeof(temp_name), "%d*[%s]", same_name_count, node->children[i]->name);
-            snprintf(node->children[i]->name, sizeof(node->children[i]->name), "%s", temp_name);
+int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
 
-            fisrt_child_flag = same_name_count == i + 1;
-        }
-        print_process_tree(node->children[i], depth + offset, i == node->child_count - 1, i == 0 || fisrt_child_flag);
+// Time every phase of a full run, rendering into memory instead of the
+// terminal. Point --proc at a tree made by fakeproc for repeatable numbers.
+// The rounds rescan the same context, so after the first (warm-up) rounds
+// they should make no heap allocations.
+void run_benchmark(int rounds)
+{
+    enum
+    {
+        PHASE_SCAN,
+        PHASE_BUILD,
+        PHASE_DETAILS,
+        PHASE_SORT,
+        PHASE_PRINT,
+        PHASE_TOTAL,
+        PHASES
+    };
+    static char *phase_names[PHASES] = {"scan", "build", "details", "sort", "print", "total"};
+    long long *times = calloc(PHASES * rounds, sizeof(long long));
+    unsigned long long *allocations = calloc(rounds, sizeof(unsigned long long));
+    int tasks = 0, processes = 0;
+    size_t bytes = 0;
+
+    for (int r = 0; r < rounds; r++)
+    {
+        unsigned long long allocated = tree.allocations + tree.out.allocations;
+        long long t0 = now_ns();
+        check_tree(proctree_read(&tree));
+        long long t1 = now_ns();
+        check_tree(proctree_build(&tree));
+        long long t2 = now_ns();
+        if (tree.lazy_details)
+            check_tree(proctree_read_details(&tree));
+        long long t3 = now_ns();
+        check_tree(proctree_sort(&tree));
+        long long t4 = now_ns();
+        tree.out.fd = -1;
+        tree.out.len = 0;
+        check_tree(print_selected_trees());
+        long long t5 = now_ns();
+
+        times[PHASE_SCAN * rounds + r] = t1 - t0;
+        times[PHASE_BUILD * rounds + r] = t2 - t1;
+        times[PHASE_DETAILS * rounds + r] = t3 - t2;
+        times[PHASE_SORT * rounds + r] = t4 - t3;
+        times[PHASE_PRINT * rounds + r] = t5 - t4;
+        times[PHASE_TOTAL * rounds + r] = t5 - t0;
+        allocations[r] = tree.allocations + tree.out.allocations - allocated;
+        tasks = tree.process_count;
+        processes = tree.scan_pid_count;
+        bytes = tree.out.len;
     }
+
+    printf("%d tasks (%d processes) in %s, %d rounds, %d scan threads, %zu bytes of output\n",
+           tasks, processes, tree.proc_root, rounds, tree.worker_count, bytes);
+    printf("heap allocations per round:");
+    for (int r = 0; r < rounds; r++)
+        printf(" %llu", allocations[r]);
+    printf("\n");
+    printf("%-8s %12s %12s %12s\n", "phase", "min ms", "median ms", "max ms");
+    for (int p = 0; p < PHASES; p++)
+    {
+        long long *t = times + p * rounds;
+        qsort(t, rounds, sizeof(long long), compare_ll);
+        printf("%-8s %12.3f %12.3f %12.3f\n", phase_names[p], t[0] / 1e6, t[rounds / 2] / 1e6, t[rounds - 1] / 1e6);
+    }
+    free(times);
+    free(allocations);
 }
 
 int main(int argc, char *argv[])
 {
+    int bench_rounds = 0;
+
+    proctree_init(&tree);
+    tree.node_data_size = sizeof(node_state_t);
+    watch_worker.pt = &tree;
+
     // handle the arguments
     for (int i = 1; i < argc; i++)
     {
         // debug use
         // printf("argv[%d]: %s\n", i, argv[i]);
 
-        if (!strchr(argv[i], '-'))
+        // pstree [PID|USER]
+        if (argv[i][0] != '-')
+        {
+            char *end;
+            long pid = strtol(argv[i], &end, 10);
+            if (*end == '\0' && pid > 0)
+            {
+                tree.root_pid = pid;
+                continue;
+            }
+            struct passwd *user = getpwnam(argv[i]);
+            if (user == NULL)
+            {
+                fprintf(stderr, "pstree: no such user name: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            tree.filter_uid = user->pw_uid;
+            continue;
+        }
+
+        // long options, kept away from the single letter checks below
+        if (strncmp(argv[i], "--", 2) == 0)
         {
+            if (strncmp(argv[i], "--threads=", 10) == 0)
+            {
+                tree.scan_threads = atoi(argv[i] + 10);
+            }
+            else if (strcmp(argv[i], "--rollup") == 0)
+            {
+                tree.show_rollup = 1;
+            }
+            else if (strncmp(argv[i], "--format=", 9) == 0)
+            {
+                if (strcmp(argv[i] + 9, "text") == 0)
+                    output_format = FORMAT_TEXT;
+                else if (strcmp(argv[i] + 9, "json") == 0)
+                    output_format = FORMAT_JSON;
+                else if (strcmp(argv[i] + 9, "binary") == 0)
+                    output_format = FORMAT_BINARY;
+                else
+                {
+                    fprintf(stderr, "pstree: unknown format %s\n", argv[i] + 9);
+                    return EXIT_FAILURE;
+                }
+            }
+            else if (strncmp(argv[i], "--record=", 9) == 0)
+            {
+                record_path = argv[i] + 9;
+            }
+            else if (strncmp(argv[i], "--replay=", 9) == 0)
+            {
+                replay_path = argv[i] + 9;
+            }
+            else if (strncmp(argv[i], "--at=", 5) == 0)
+            {
+                replay_at = atof(argv[i] + 5);
+            }
+            else if (strncmp(argv[i], "--proc=", 7) == 0)
+            {
+                tree.proc_root = argv[i] + 7;
+            }
+            else if (strncmp(argv[i], "--bench", 7) == 0)
+            {
+                bench_rounds = argv[i][7] == '=' ? atoi(argv[i] + 8) : 5;
+                if (bench_rounds <= 0)
+                {
+                    fprintf(stderr, "pstree: bad number of rounds %s\n", argv[i] + 8);
+                    return EXIT_FAILURE;
+                }
+            }
+            else if (strncmp(argv[i], "--watch=", 8) == 0)
+            {
+                watch_interval_ms = atof(argv[i] + 8) * 1000;
+                if (watch_interval_ms <= 0)
+                {
+                    fprintf(stderr, "pstree: bad watch interval %s\n", argv[i] + 8);
+                    return EXIT_FAILURE;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "pstree: unknown option %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
             continue;
         }
 
         if (strchr(argv[i], 'T'))
         {
-            show_threads = 0;
+            tree.show_threads = 0;
         }
         if (strchr(argv[i], 't'))
         {
-            use_thread_names = 1;
+            tree.use_thread_names = 1;
         }
         if (strchr(argv[i], 'p'))
         {
-            show_pid = 1;
+            tree.show_pid = 1;
         }
         if (strchr(argv[i], 'c'))
         {
-            show_compact = 0;
+            tree.show_compact = 0;
         }
         if (strchr(argv[i], 'a'))
         {
-            show_cmdline = 1;
-            align_mode = 0;
+            tree.show_cmdline = 1;
+            tree.align_mode = 0;
         }
         if (strchr(argv[i], 'n'))
         {
-            sort_by_pid = 1;
+            tree.sort_by_pid = 1;
         }
         if (strchr(argv[i], 'A'))
         {
-            branch_chars = branch_chars_ascii;
-            show_ascii_tree = 1;
+            tree.branch_chars = proctree_branch_chars_ascii;
         }
     }
 
-    read_all_processes();
-    build_process_tree();
+    if (replay_path != NULL)
+    {
+        history_replay();
+        check_tree(proctree_build(&tree));
+        check_tree(proctree_sort(&tree));
+        check_tree(print_selected_trees());
+        proctree_out_flush(&tree.out);
+        check_output(&tree.out, "stdout");
+        return 0;
+    }
+    if (record_path != NULL)
+    {
+        // the log holds processes only
+        history_open();
+        tree.show_threads = 0;
+        tree.show_cmdline = 0;
+        if (!watch_interval_ms)
+            watch_interval_ms = 1000;
+    }
+
+    // watch mode re-reads processes as they come, so it always reads everything
+    tree.lazy_details = (tree.root_pid != 1 || tree.filter_uid >= 0) && !watch_interval_ms;
 
-    if (process_tree[1] != NULL)
+    if (bench_rounds)
     {
-        print_process_tree(process_tree[1], -1, 1, 1);
+        run_benchmark(bench_rounds);
+        return 0;
     }
 
+    check_tree(proctree_scan(&tree));
+
+    if (watch_interval_ms)
+    {
+        watch_processes();
+    }
+
+    check_tree(print_selected_trees());
+    proctree_out_flush(&tree.out);
+    check_output(&tree.out, "stdout");
+
     return 0;
 }
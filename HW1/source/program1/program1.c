@@ -1,14 +1,199 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <spawn.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <signal.h>
 
-void signal_handler()
+extern char **environ;
+
+#define CLONE_STACK_SIZE (64 * 1024)
+#define BENCH_DEFAULT_ITERATIONS 200
+#define BENCH_MAX_RSS_SIZES 16
+#define HIST_BUCKETS 40
+#define MAX_EVENTS 256
+
+#define PERF_COUNTERS 3
+#define DEFAULT_GRACE_NS 2000000000LL
+#define MAX_SYSCALLS 512
+
+// epoll data tags, children use their index + 1
+#define EV_SIGCHLD 0
+#define EV_TIMER (1ULL << 32)
+#define EV_OUTPUT (1ULL << 33) // | index << 1 | stream (0 stdout, 1 stderr)
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef PTRACE_GET_SYSCALL_INFO
+#define PTRACE_GET_SYSCALL_INFO 0x420e
+#define PTRACE_SYSCALL_INFO_ENTRY 1
+#define PTRACE_SYSCALL_INFO_EXIT 2
+#endif
+
+// how the child process is created before it execs the test program
+enum launch_backend
 {
-	printf("Parent process receives SIGCHLD signal\n");
-}
+	BACKEND_FORK,
+	BACKEND_VFORK,
+	BACKEND_SPAWN,
+	BACKEND_CLONE,
+	BACKEND_ZYGOTE,
+	BACKEND_COUNT
+};
+
+char *backend_names[] = {"fork", "vfork", "spawn", "clone", "zygote"};
+
+// everything the child needs between creation and execv()
+typedef struct launch_request
+{
+	char *path;
+	char **argv;
+	int stdio[3];	   // fd to install as stdin/stdout/stderr, -1 to inherit
+	sigset_t *sigmask; // signal mask the test program starts with, NULL to inherit
+	int gate_fd;	   // fork backend only: block until a byte arrives here, -1 for none
+	int exec_fd;	   // kept open in the child until exec, -1 for none (zygote forwards it)
+	int pidfd;		   // set by backends that hand back a pidfd, -1 otherwise
+	int verbose;	   // fork backend only: print the child banner before exec
+} launch_request_t;
+
+// how the zygote's children run the test program
+enum zygote_mode
+{
+	ZYGOTE_EXEC,	  // fexecve() of the binary the zygote keeps open
+	ZYGOTE_IN_PROCESS // call main() of the binary the zygote dlopen()ed
+};
+
+char *zygote_mode_names[] = {"exec", "in-process"};
+
+// supervisor -> zygote, followed by the descriptors flagged here
+typedef struct zygote_request
+{
+	int has_stdio[3];
+	int has_exec_fd;
+} zygote_request_t;
+
+// zygote -> supervisor, with the child's pidfd attached; the first one is
+// sent once at startup and carries the zygote's own pid and mode instead
+typedef struct zygote_reply
+{
+	pid_t pid;
+	int err;
+	enum zygote_mode mode;
+} zygote_reply_t;
+
+pid_t zygote_pid = -1;
+int zygote_sock = -1;
+enum zygote_mode zygote_mode = ZYGOTE_EXEC;
+
+enum child_state
+{
+	CHILD_RUNNING,
+	CHILD_STOPPED,
+	CHILD_DONE
+};
+
+enum timeout_reason
+{
+	TIMEOUT_NONE,
+	TIMEOUT_WALL,
+	TIMEOUT_CPU
+};
+
+char *timeout_names[] = {"", "wall-clock", "CPU time"};
+
+enum stats_format
+{
+	STATS_NONE,
+	STATS_CSV,
+	STATS_JSON
+};
+
+// software counters read per child when perf_event_open() is permitted
+struct perf_counter
+{
+	char *name;
+	unsigned long long config;
+} perf_counters[PERF_COUNTERS] = {
+	{"task_clock_ns", PERF_COUNT_SW_TASK_CLOCK},
+	{"page_faults", PERF_COUNT_SW_PAGE_FAULTS},
+	{"cpu_migrations", PERF_COUNT_SW_CPU_MIGRATIONS},
+};
+
+// one launched instance of the test program
+typedef struct child
+{
+	pid_t pid;
+	int pidfd; // readable once the child exits, -1 after it is reaped
+	enum child_state state;
+	int status; // last wait status reported for the child
+	long long start_ns, end_ns;
+	struct rusage ru;
+	int perf_fd[PERF_COUNTERS]; // -1 when the counter could not be opened
+	clockid_t cpu_clock;
+	enum timeout_reason timeout; // set once SIGTERM was sent for a limit
+	long long kill_at_ns;		 // SIGKILL deadline after SIGTERM, 0 if none
+	int out_fd[2];				 // read ends of the stdout/stderr pipes, -1 if not captured
+	int log_fd[2];				 // per-child log files, -1 without a log directory
+	struct syscall_profile *profile; // ptrace syscall statistics, NULL unless profiling
+} child_t;
+
+// supervisor state shared by the event loop helpers
+typedef struct supervisor
+{
+	child_t *children;
+	int count;		  // instances to launch in total
+	int launched;	  // instances launched so far
+	int live;		  // launched and not yet done
+	int *pid_slots;	  // open-addressing pid -> child index + 1
+	int pid_mask;	  // pid_slots size - 1
+	int epfd;
+	int sigfd;		  // SIGCHLD is blocked and read from here instead
+	int follow;		  // keep tracking stopped children until they exit
+	int exited, signaled, stopped, timed_out;
+	int timerfd;	  // armed for the earliest pending deadline
+	long long wall_limit_ns, cpu_limit_ns, grace_ns; // 0 disables a limit
+	long long next_cpu_check_ns;
+	int wall_head;	  // oldest child whose wall deadline may still fire
+	int *kill_queue;  // children sent SIGTERM, in order of their SIGKILL deadline
+	int kill_head, kill_tail;
+	char *log_dir;	  // per-child <program>.<pid>.out/.err files, NULL if unused
+	int merged_fd;	  // tagged log of every child's output, -1 if unused
+	int tee_pipe[2];  // scratch pipe to tee() into when both logs are written
+	int open_outputs; // capture pipes not at EOF yet, they may outlive their child
+	int profile;			// trace every child's syscalls with ptrace
+	int sigchld_unreported; // SIGCHLD arrived, its message is not printed yet
+	char *program;
+	char *backend;
+	FILE *stats;	  // per-child resource records, NULL when disabled
+	enum stats_format stats_format;
+	int stats_rows;	  // records written so far
+} supervisor_t;
+
+int perf_available = 1; // cleared after the first refusal
 
 char *map_status(int status)
 {
@@ -160,63 +345,2124 @@ char *map_status(int status)
 	return status_str;
 }
 
-int main(int argc, char *argv[])
+/* ---------------------------- launch backends ---------------------------- */
+
+// Runs in the child before execv(). For vfork and clone(CLONE_VM) the child
+// shares the parent's memory, so only async-signal-safe calls are allowed.
+void child_setup_stdio(launch_request_t *req)
 {
-	signal(SIGCHLD, signal_handler);
+	for (int i = 0; i < 3; i++)
+	{
+		if (req->stdio[i] >= 0 && req->stdio[i] != i)
+			dup2(req->stdio[i], i);
+	}
+	if (req->sigmask)
+		sigprocmask(SIG_SETMASK, req->sigmask, NULL);
+}
 
-	/* fork a child process */
-	printf("Process start to fork\n");
-	int pid = fork();
+int clone_child_main(void *arg)
+{
+	launch_request_t *req = arg;
+	child_setup_stdio(req);
+	execv(req->path, req->argv);
+	_exit(127);
+}
 
-	/* execute test program */
+pid_t launch_fork(launch_request_t *req)
+{
+	fflush(stdout);
+	pid_t pid = fork();
 	if (pid == 0)
 	{
 		/* child process */
-		printf("I'm the Child Process, my pid = %d\n", getpid());
-		printf("Child process start to execute test program: \n");
-		execl(argv[1], argv[1], NULL);
+		if (req->verbose)
+		{
+			printf("I'm the Child Process, my pid = %d\n", getpid());
+			printf("Child process start to execute test program: \n");
+			fflush(stdout);
+		}
+		if (req->gate_fd >= 0)
+		{
+			// wait until the supervisor has attached to us
+			char c;
+			while (read(req->gate_fd, &c, 1) == -1 && errno == EINTR)
+				;
+		}
+		child_setup_stdio(req);
+		execv(req->path, req->argv);
+		perror("execv");
+		_exit(127);
 	}
-	else
+	return pid;
+}
+
+pid_t launch_vfork(launch_request_t *req)
+{
+	pid_t pid = vfork();
+	if (pid == 0)
 	{
-		printf("I'm the Parent Process, my pid = %d\n", getpid());
+		child_setup_stdio(req);
+		execv(req->path, req->argv);
+		_exit(127);
 	}
+	return pid;
+}
+
+pid_t launch_spawn(launch_request_t *req)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	for (int i = 0; i < 3; i++)
+	{
+		if (req->stdio[i] >= 0 && req->stdio[i] != i)
+			posix_spawn_file_actions_adddup2(&actions, req->stdio[i], i);
+	}
+
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	if (req->sigmask)
+	{
+		posix_spawnattr_setsigmask(&attr, req->sigmask);
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+	}
+
+	pid_t pid;
+	int err = posix_spawn(&pid, req->path, &actions, &attr, req->argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (err != 0)
+	{
+		errno = err;
+		return -1;
+	}
+	return pid;
+}
+
+pid_t launch_clone(launch_request_t *req)
+{
+	// CLONE_VFORK keeps the parent suspended until the child execs, so one
+	// stack can be reused for every launch.
+	static char *stack = NULL;
+	if (stack == NULL)
+	{
+		stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (stack == MAP_FAILED)
+		{
+			stack = NULL;
+			return -1;
+		}
+	}
+
+	return clone(clone_child_main, stack + CLONE_STACK_SIZE,
+				 CLONE_VM | CLONE_VFORK | SIGCHLD, req);
+}
+
+/* --------------------------------- zygote --------------------------------- */
+
+int send_fds(int sock, void *buf, size_t len, int *fds, int nfds)
+{
+	struct iovec iov = {.iov_base = buf, .iov_len = len};
+	char control[CMSG_SPACE(sizeof(int) * 4)];
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+	if (nfds > 0)
+	{
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+// returns the number of descriptors received, -1 on error or EOF
+int recv_fds(int sock, void *buf, size_t len, int *fds, int maxfds)
+{
+	struct iovec iov = {.iov_base = buf, .iov_len = len};
+	char control[CMSG_SPACE(sizeof(int) * 4)];
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+
+	ssize_t n;
+	while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+		;
+	if (n != (ssize_t)len)
+		return -1;
+
+	int nfds = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		{
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (nfds > maxfds)
+				nfds = maxfds;
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+		}
+	}
+	return nfds;
+}
+
+// The grandchild: install the forwarded descriptors, then either exec the
+// preloaded binary or run its main() directly.
+void zygote_child(char *path, char **argv, int exe_fd, int (*main_fn)(int, char **, char **),
+				  zygote_request_t *zreq, int *fds)
+{
+	int next = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		if (zreq->has_stdio[i])
+			dup2(fds[next++], i);
+	}
+	int exec_fd = zreq->has_exec_fd ? fds[next] : -1;
+
+	if (main_fn)
+	{
+		int argc = 0;
+		while (argv[argc])
+			argc++;
+		if (exec_fd >= 0)
+			close(exec_fd); // "exec" is the call into main()
+		exit(main_fn(argc, argv, environ));
+	}
+
+	fexecve(exe_fd, argv, environ);
+	execv(path, argv); // fexecve() needs /proc or execveat()
+	_exit(127);
+}
+
+// The template process. It is forked before the supervisor grows, keeps the
+// test binary open (and dlopen()ed when that works) and forks each child on
+// request. Children are double-forked so they are orphaned onto the
+// supervisor, which is a child subreaper, and it can reap them like its own.
+void zygote_main(int sock, char *path, char **argv)
+{
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+	int exe_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (exe_fd >= 0)
+		posix_fadvise(exe_fd, 0, 0, POSIX_FADV_WILLNEED);
+
+	// Only shared objects can be dlopen()ed (make builds every test program
+	// as NAME.so too); a PIE executable is refused, and then the children
+	// exec as usual.
+	int (*main_fn)(int, char **, char **) = NULL;
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle)
+		main_fn = (int (*)(int, char **, char **))dlsym(handle, "main");
+
+	zygote_reply_t hello = {.pid = getpid(), .mode = main_fn ? ZYGOTE_IN_PROCESS : ZYGOTE_EXEC};
+	send_fds(sock, &hello, sizeof(hello), NULL, 0);
+
+	int relay[2];
+	if (pipe2(relay, O_CLOEXEC) == -1)
+		_exit(EXIT_FAILURE);
 
-	/* wait for child process terminates */
-	int status;
 	while (1)
 	{
-		pid_t result = waitpid(pid, &status, WUNTRACED | WCONTINUED); // save the termination status of child process
+		zygote_request_t zreq;
+		int fds[4];
+		int nfds = recv_fds(sock, &zreq, sizeof(zreq), fds, 4);
+		if (nfds == -1)
+			_exit(0); // supervisor went away
 
-		if (result == -1)
+		zygote_reply_t reply = {.pid = -1, .err = 0, .mode = hello.mode};
+		pid_t mid = fork();
+		if (mid == 0)
 		{
-			printf("waitpid error\n");
-			exit(EXIT_FAILURE);
+			pid_t pid = fork();
+			if (pid == 0)
+				zygote_child(path, argv, exe_fd, main_fn, &zreq, fds);
+			write(relay[1], &pid, sizeof(pid));
+			_exit(0);
 		}
+		for (int i = 0; i < nfds; i++)
+			close(fds[i]);
+
+		int pidfd = -1;
+		if (mid == -1 || read(relay[0], &reply.pid, sizeof(reply.pid)) != sizeof(reply.pid))
+			reply.pid = -1;
+		if (mid != -1)
+			waitpid(mid, NULL, 0); // once reaped, the grandchild belongs to the supervisor
+		if (reply.pid == -1)
+			reply.err = EAGAIN;
+		else
+			pidfd = syscall(SYS_pidfd_open, reply.pid, 0);
+		send_fds(sock, &reply, sizeof(reply), &pidfd, pidfd >= 0 ? 1 : 0);
+		if (pidfd >= 0)
+			close(pidfd);
+	}
+}
+
+// Must run before the supervisor buffers output or grows: the zygote and its
+// in-process children inherit both.
+int zygote_start(char *path, char **argv)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+		return -1;
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1)
+		return -1;
+
+	fflush(NULL);
+	zygote_pid = fork();
+	if (zygote_pid == -1)
+		return -1;
+	if (zygote_pid == 0)
+	{
+		close(sv[0]);
+		zygote_main(sv[1], path, argv);
+	}
+	close(sv[1]);
+	zygote_sock = sv[0];
+
+	zygote_reply_t hello;
+	if (recv_fds(zygote_sock, &hello, sizeof(hello), NULL, 0) == -1)
+		return -1;
+	zygote_mode = hello.mode;
+	return 0;
+}
+
+void zygote_stop(void)
+{
+	if (zygote_pid <= 0)
+		return;
+	close(zygote_sock); // the zygote exits on EOF
+	waitpid(zygote_pid, NULL, 0);
+	zygote_sock = -1;
+	zygote_pid = -1;
+}
+
+pid_t launch_zygote(launch_request_t *req)
+{
+	zygote_request_t zreq = {.has_exec_fd = req->exec_fd >= 0};
+	int fds[4], nfds = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		zreq.has_stdio[i] = req->stdio[i] >= 0;
+		if (zreq.has_stdio[i])
+			fds[nfds++] = req->stdio[i];
+	}
+	if (zreq.has_exec_fd)
+		fds[nfds++] = req->exec_fd;
+
+	zygote_reply_t reply;
+	int pidfd = -1;
+	if (zygote_sock < 0 || send_fds(zygote_sock, &zreq, sizeof(zreq), fds, nfds) == -1 ||
+		recv_fds(zygote_sock, &reply, sizeof(reply), &pidfd, 1) == -1)
+	{
+		errno = ECHILD;
+		return -1;
+	}
+	if (reply.pid == -1)
+	{
+		errno = reply.err;
+		return -1;
+	}
+	req->pidfd = pidfd;
+	return reply.pid;
+}
+
+pid_t launch_child(enum launch_backend backend, launch_request_t *req)
+{
+	req->pidfd = -1;
+	switch (backend)
+	{
+	case BACKEND_FORK:
+		return launch_fork(req);
+	case BACKEND_VFORK:
+		return launch_vfork(req);
+	case BACKEND_SPAWN:
+		return launch_spawn(req);
+	case BACKEND_CLONE:
+		return launch_clone(req);
+	case BACKEND_ZYGOTE:
+		return launch_zygote(req);
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+int parse_backend(const char *name)
+{
+	for (int i = 0; i < BACKEND_COUNT; i++)
+	{
+		if (strcmp(name, backend_names[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* ------------------------------- benchmark -------------------------------- */
+
+long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int compare_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+// bucket k holds samples in [2^k, 2^(k+1)) ns
+int hist_bucket(long long ns)
+{
+	int k = 0;
+	while (ns > 1 && k < HIST_BUCKETS - 1)
+	{
+		ns >>= 1;
+		k++;
+	}
+	return k;
+}
+
+void print_latency(const char *label, long long *samples, int n)
+{
+	if (n == 0)
+		return;
+
+	long long hist[HIST_BUCKETS] = {0}, sum = 0, peak = 0;
+	for (int i = 0; i < n; i++)
+	{
+		hist[hist_bucket(samples[i])]++;
+		sum += samples[i];
+	}
+	qsort(samples, n, sizeof(long long), compare_ll);
+
+	printf("  %s: min %.1fus  p50 %.1fus  p90 %.1fus  p99 %.1fus  max %.1fus  mean %.1fus\n",
+		   label, samples[0] / 1e3, samples[n / 2] / 1e3, samples[n * 9 / 10] / 1e3,
+		   samples[n * 99 / 100] / 1e3, samples[n - 1] / 1e3, sum / 1e3 / n);
+
+	for (int k = 0; k < HIST_BUCKETS; k++)
+		if (hist[k] > peak)
+			peak = hist[k];
+	for (int k = 0; k < HIST_BUCKETS; k++)
+	{
+		if (hist[k] == 0)
+			continue;
+		int width = (int)(hist[k] * 40 / peak);
+		printf("    [%9.1fus, %9.1fus) %6lld ", (1LL << k) / 1e3, (1LL << (k + 1)) / 1e3, hist[k]);
+		for (int i = 0; i < width; i++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+// Grow (or shrink) an anonymous, fully touched mapping so the parent's RSS
+// is roughly mb megabytes larger than at startup.
+void set_ballast(size_t mb)
+{
+	static char *ballast = NULL;
+	static size_t ballast_size = 0;
+
+	if (ballast)
+		munmap(ballast, ballast_size);
+	ballast = NULL;
+	ballast_size = mb << 20;
+	if (ballast_size == 0)
+		return;
+
+	ballast = mmap(NULL, ballast_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ballast == MAP_FAILED)
+	{
+		perror("mmap ballast");
+		exit(EXIT_FAILURE);
+	}
+	memset(ballast, 0x5a, ballast_size);
+}
+
+// One measured launch: spawn-to-exec is detected through a close-on-exec
+// pipe whose write end disappears when the child's execv() succeeds.
+int bench_once(enum launch_backend backend, launch_request_t *req, long long *to_exec, long long *to_reap)
+{
+	int exec_pipe[2];
+	if (pipe2(exec_pipe, O_CLOEXEC) == -1)
+		return -1;
+
+	long long start = now_ns();
+	req->exec_fd = exec_pipe[1];
+	pid_t pid = launch_child(backend, req);
+	req->exec_fd = -1;
+	close(exec_pipe[1]);
+	if (pid == -1)
+	{
+		close(exec_pipe[0]);
+		return -1;
+	}
+	if (req->pidfd >= 0)
+		close(req->pidfd);
+
+	char c;
+	while (read(exec_pipe[0], &c, 1) == -1 && errno == EINTR)
+		;
+	*to_exec = now_ns() - start;
+	close(exec_pipe[0]);
+
+	int status;
+	while (waitpid(pid, &status, 0) == -1)
+	{
+		if (errno != EINTR)
+			return -1;
+	}
+	*to_reap = now_ns() - start;
+	return status;
+}
+
+void usage_bench(void)
+{
+	fprintf(stderr, "usage: program1 bench [-b BACKEND|all] [-n ITERATIONS] [-m MB[,MB...]] TEST_CASE [ARG...]\n");
+	exit(EXIT_FAILURE);
+}
 
-		/* check child process'  termination status */
+int run_bench(int argc, char *argv[])
+{
+	int backend = -1; // all backends
+	int iterations = BENCH_DEFAULT_ITERATIONS;
+	size_t rss_sizes[BENCH_MAX_RSS_SIZES] = {0};
+	int rss_count = 1;
+	int opt;
 
-		if (WIFEXITED(status))
+	while ((opt = getopt(argc, argv, "+b:n:m:")) != -1)
+	{
+		switch (opt)
 		{
-			printf("Normal termination with EXIT STATUS = %d\n", WEXITSTATUS(status));
+		case 'b':
+			backend = strcmp(optarg, "all") == 0 ? -1 : parse_backend(optarg);
+			if (backend == -1 && strcmp(optarg, "all") != 0)
+				usage_bench();
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0)
+				usage_bench();
+			break;
+		case 'm':
+			rss_count = 0;
+			for (char *tok = strtok(optarg, ","); tok && rss_count < BENCH_MAX_RSS_SIZES; tok = strtok(NULL, ","))
+				rss_sizes[rss_count++] = strtoul(tok, NULL, 10);
+			if (rss_count == 0)
+				usage_bench();
 			break;
+		default:
+			usage_bench();
 		}
+	}
+	if (optind >= argc)
+		usage_bench();
 
-		if (WIFSIGNALED(status))
+	if (backend == -1 || backend == BACKEND_ZYGOTE)
+	{
+		if (zygote_start(argv[optind], &argv[optind]) == -1)
 		{
-			char *status_str = map_status(WTERMSIG(status));
-			if (status_str == NULL)
-				status_str = "UNKNOWN";
-			printf("child process get %s signal\n", status_str);
-			break;
+			perror("zygote");
+			exit(EXIT_FAILURE);
+		}
+		printf("zygote %d ready, children run %s in %s mode\n", zygote_pid, argv[optind], zygote_mode_names[zygote_mode]);
+	}
+
+	// keep the children's output out of the measurements
+	int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+	launch_request_t req = {
+		.path = argv[optind],
+		.argv = &argv[optind],
+		.stdio = {devnull, devnull, devnull},
+		.sigmask = NULL,
+		.gate_fd = -1,
+		.exec_fd = -1,
+		.verbose = 0};
+
+	long long *to_exec = malloc(sizeof(long long) * iterations);
+	long long *to_reap = malloc(sizeof(long long) * iterations);
+	if (!to_exec || !to_reap)
+	{
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int r = 0; r < rss_count; r++)
+	{
+		set_ballast(rss_sizes[r]);
+
+		for (int b = 0; b < BACKEND_COUNT; b++)
+		{
+			if (backend != -1 && b != backend)
+				continue;
+
+			int n = 0, failed = 0;
+			long long started = now_ns();
+			for (int i = 0; i < iterations; i++)
+			{
+				int status = bench_once(b, &req, &to_exec[n], &to_reap[n]);
+				if (status == -1)
+				{
+					perror(backend_names[b]);
+					break;
+				}
+				if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+					failed++;
+				n++;
+			}
+
+			long long elapsed = now_ns() - started;
+
+			printf("%s, parent ballast %zu MB, %d launches (%d abnormal exits), %.0f launches/s\n",
+				   backend_names[b], rss_sizes[r], n, failed, elapsed > 0 ? n * 1e9 / elapsed : 0.0);
+			print_latency("spawn-to-exec", to_exec, n);
+			print_latency("spawn-to-reap", to_reap, n);
+		}
+	}
+
+	free(to_exec);
+	free(to_reap);
+	set_ballast(0);
+	close(devnull);
+	zygote_stop();
+	return 0;
+}
+
+/* ----------------------------- output capture ----------------------------- */
+
+// move exactly len bytes between a pipe and a file without a user-space copy
+int splice_all(int in, int out, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+		if (n <= 0)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+// Pipes are created before the launch; the child gets the write ends as its
+// stdout and stderr and the supervisor keeps the non-blocking read ends.
+int prepare_output(supervisor_t *sv, child_t *c, launch_request_t *req, int pipes[2][2])
+{
+	for (int s = 0; s < 2; s++)
+	{
+		c->out_fd[s] = c->log_fd[s] = -1;
+		pipes[s][0] = pipes[s][1] = -1;
+	}
+	if (!sv->log_dir && sv->merged_fd < 0)
+		return 0;
+
+	for (int s = 0; s < 2; s++)
+	{
+		if (pipe2(pipes[s], O_CLOEXEC) == -1)
+			return -1;
+		fcntl(pipes[s][0], F_SETFL, O_NONBLOCK);
+		req->stdio[s + 1] = pipes[s][1];
+	}
+	return 0;
+}
+
+void attach_output(supervisor_t *sv, child_t *c, int index, int pipes[2][2])
+{
+	static char *suffix[] = {"out", "err"};
+	char *base = strrchr(sv->program, '/') ? strrchr(sv->program, '/') + 1 : sv->program;
+
+	for (int s = 0; s < 2; s++)
+	{
+		if (pipes[s][1] >= 0)
+			close(pipes[s][1]);
+		if (pipes[s][0] < 0)
+			continue;
+
+		c->out_fd[s] = pipes[s][0];
+		sv->open_outputs++;
+		struct epoll_event ev = {.events = EPOLLIN, .data.u64 = EV_OUTPUT | (unsigned long long)index << 1 | s};
+		epoll_ctl(sv->epfd, EPOLL_CTL_ADD, c->out_fd[s], &ev);
+
+		if (sv->log_dir)
+		{
+			char path[4096];
+			snprintf(path, sizeof(path), "%s/%s.%d.%s", sv->log_dir, base, c->pid, suffix[s]);
+			// no O_APPEND: splice() refuses to write to append-only files
+			c->log_fd[s] = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (c->log_fd[s] == -1)
+				perror(path);
 		}
+	}
+}
+
+// reads and drops whatever a non-blocking pipe holds
+void discard_pipe(int fd)
+{
+	char buf[4096];
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+// Moves avail bytes from the pipe into the logs. With both a log directory
+// and a merged log the data is tee()d into the scratch pipe first, so it
+// reaches both files without passing through user space.
+int move_output(supervisor_t *sv, child_t *c, int s, int avail)
+{
+	static char *stream_names[] = {"stdout", "stderr"};
+	int fd = c->out_fd[s];
+
+	if (sv->merged_fd < 0)
+		return c->log_fd[s] < 0 ? -1 : splice_all(fd, c->log_fd[s], avail);
+
+	int in = fd;
+	if (sv->log_dir && c->log_fd[s] >= 0)
+	{
+		ssize_t n = tee(fd, sv->tee_pipe[1], avail, SPLICE_F_NONBLOCK);
+		if (n <= 0)
+			return -1;
+		avail = n;
+		in = sv->tee_pipe[0];
+	}
+	dprintf(sv->merged_fd, "==> %d %s %d bytes <==\n", c->pid, stream_names[s], avail);
+	if (splice_all(in, sv->merged_fd, avail) == -1)
+		return -1;
+	if (in != fd && splice_all(fd, c->log_fd[s], avail) == -1)
+		return -1;
+	return 0;
+}
+
+// Moves whatever the pipe holds right now. Output that cannot be stored (no
+// log file, a full disk) is read and dropped: left in the pipe it would
+// block the child and keep the level-triggered EPOLLIN firing.
+void drain_output(supervisor_t *sv, child_t *c, int s)
+{
+	int fd = c->out_fd[s];
 
-		if (WIFSTOPPED(status))
+	while (1)
+	{
+		int avail = 0;
+		if (ioctl(fd, FIONREAD, &avail) == 0 && avail == 0)
+			break;
+		if (avail == 0 || move_output(sv, c, s, avail) == -1)
 		{
-			char *status_str = map_status(WSTOPSIG(status));
-			if (status_str == NULL)
-				status_str = "UNKNOWN";
-			printf("child process get %s signal\n", status_str);
+			discard_pipe(fd);
+			if (sv->tee_pipe[0] >= 0)
+				discard_pipe(sv->tee_pipe[0]);
 			break;
 		}
 	}
 }
+
+void close_output(supervisor_t *sv, child_t *c, int s)
+{
+	if (c->out_fd[s] >= 0)
+	{
+		close(c->out_fd[s]);
+		sv->open_outputs--;
+	}
+	if (c->log_fd[s] >= 0)
+		close(c->log_fd[s]);
+	c->out_fd[s] = c->log_fd[s] = -1;
+}
+
+void handle_output(supervisor_t *sv, unsigned long long tag, unsigned int events)
+{
+	child_t *c = &sv->children[(tag & ~EV_OUTPUT) >> 1];
+	int s = tag & 1;
+	if (c->out_fd[s] < 0)
+		return;
+	drain_output(sv, c, s);
+	// all writers gone and nothing left: stop polling a permanently ready fd
+	if ((events & EPOLLHUP) && !(events & EPOLLIN))
+		close_output(sv, c, s);
+}
+
+// Once every child is done only daemonised grandchildren can still hold a
+// capture pipe. They get the grace period to finish writing, then program1
+// stops listening. Returns the epoll_wait() timeout, 0 when it is over.
+int output_linger_ms(supervisor_t *sv, long long *deadline)
+{
+	if (sv->live > 0)
+		return -1;
+	if (*deadline == 0)
+		*deadline = now_ns() + sv->grace_ns;
+	long long left = *deadline - now_ns();
+	if (left > 0)
+		return left / 1000000 + 1;
+
+	for (int i = 0; i < sv->launched; i++)
+	{
+		for (int s = 0; s < 2; s++)
+		{
+			if (sv->children[i].out_fd[s] >= 0)
+				drain_output(sv, &sv->children[i], s);
+			close_output(sv, &sv->children[i], s);
+		}
+	}
+	return 0;
+}
+
+/* ----------------------------- syscall profile ----------------------------- */
+
+// layout of the kernel's struct ptrace_syscall_info (Linux 5.3+)
+struct syscall_trace_info
+{
+	unsigned char op;
+	unsigned char pad[3];
+	unsigned int arch;
+	unsigned long long instruction_pointer;
+	unsigned long long stack_pointer;
+	union
+	{
+		struct
+		{
+			unsigned long long nr;
+			unsigned long long args[6];
+		} entry;
+		struct
+		{
+			long long rval;
+			unsigned char is_error;
+		} exit;
+	};
+};
+
+// per-child counterpart of strace -c
+typedef struct syscall_profile
+{
+	long long calls[MAX_SYSCALLS];
+	long long errors[MAX_SYSCALLS];
+	long long time_ns[MAX_SYSCALLS];
+	long long entry_ns; // when the syscall in progress was entered
+	int current;		// its number, -1 outside a syscall
+} syscall_profile_t;
+
+struct syscall_name
+{
+	long nr;
+	char *name;
+} syscall_names[] = {
+#ifdef SYS_read
+	{SYS_read, "read"},
+#endif
+#ifdef SYS_write
+	{SYS_write, "write"},
+#endif
+#ifdef SYS_open
+	{SYS_open, "open"},
+#endif
+#ifdef SYS_close
+	{SYS_close, "close"},
+#endif
+#ifdef SYS_stat
+	{SYS_stat, "stat"},
+#endif
+#ifdef SYS_fstat
+	{SYS_fstat, "fstat"},
+#endif
+#ifdef SYS_lstat
+	{SYS_lstat, "lstat"},
+#endif
+#ifdef SYS_poll
+	{SYS_poll, "poll"},
+#endif
+#ifdef SYS_lseek
+	{SYS_lseek, "lseek"},
+#endif
+#ifdef SYS_mmap
+	{SYS_mmap, "mmap"},
+#endif
+#ifdef SYS_mprotect
+	{SYS_mprotect, "mprotect"},
+#endif
+#ifdef SYS_munmap
+	{SYS_munmap, "munmap"},
+#endif
+#ifdef SYS_brk
+	{SYS_brk, "brk"},
+#endif
+#ifdef SYS_rt_sigaction
+	{SYS_rt_sigaction, "rt_sigaction"},
+#endif
+#ifdef SYS_rt_sigprocmask
+	{SYS_rt_sigprocmask, "rt_sigprocmask"},
+#endif
+#ifdef SYS_rt_sigreturn
+	{SYS_rt_sigreturn, "rt_sigreturn"},
+#endif
+#ifdef SYS_ioctl
+	{SYS_ioctl, "ioctl"},
+#endif
+#ifdef SYS_pread64
+	{SYS_pread64, "pread64"},
+#endif
+#ifdef SYS_pwrite64
+	{SYS_pwrite64, "pwrite64"},
+#endif
+#ifdef SYS_readv
+	{SYS_readv, "readv"},
+#endif
+#ifdef SYS_writev
+	{SYS_writev, "writev"},
+#endif
+#ifdef SYS_access
+	{SYS_access, "access"},
+#endif
+#ifdef SYS_pipe
+	{SYS_pipe, "pipe"},
+#endif
+#ifdef SYS_select
+	{SYS_select, "select"},
+#endif
+#ifdef SYS_sched_yield
+	{SYS_sched_yield, "sched_yield"},
+#endif
+#ifdef SYS_mremap
+	{SYS_mremap, "mremap"},
+#endif
+#ifdef SYS_msync
+	{SYS_msync, "msync"},
+#endif
+#ifdef SYS_madvise
+	{SYS_madvise, "madvise"},
+#endif
+#ifdef SYS_dup
+	{SYS_dup, "dup"},
+#endif
+#ifdef SYS_dup2
+	{SYS_dup2, "dup2"},
+#endif
+#ifdef SYS_pause
+	{SYS_pause, "pause"},
+#endif
+#ifdef SYS_nanosleep
+	{SYS_nanosleep, "nanosleep"},
+#endif
+#ifdef SYS_getitimer
+	{SYS_getitimer, "getitimer"},
+#endif
+#ifdef SYS_alarm
+	{SYS_alarm, "alarm"},
+#endif
+#ifdef SYS_setitimer
+	{SYS_setitimer, "setitimer"},
+#endif
+#ifdef SYS_getpid
+	{SYS_getpid, "getpid"},
+#endif
+#ifdef SYS_sendfile
+	{SYS_sendfile, "sendfile"},
+#endif
+#ifdef SYS_socket
+	{SYS_socket, "socket"},
+#endif
+#ifdef SYS_connect
+	{SYS_connect, "connect"},
+#endif
+#ifdef SYS_accept
+	{SYS_accept, "accept"},
+#endif
+#ifdef SYS_sendto
+	{SYS_sendto, "sendto"},
+#endif
+#ifdef SYS_recvfrom
+	{SYS_recvfrom, "recvfrom"},
+#endif
+#ifdef SYS_sendmsg
+	{SYS_sendmsg, "sendmsg"},
+#endif
+#ifdef SYS_recvmsg
+	{SYS_recvmsg, "recvmsg"},
+#endif
+#ifdef SYS_shutdown
+	{SYS_shutdown, "shutdown"},
+#endif
+#ifdef SYS_bind
+	{SYS_bind, "bind"},
+#endif
+#ifdef SYS_listen
+	{SYS_listen, "listen"},
+#endif
+#ifdef SYS_clone
+	{SYS_clone, "clone"},
+#endif
+#ifdef SYS_fork
+	{SYS_fork, "fork"},
+#endif
+#ifdef SYS_vfork
+	{SYS_vfork, "vfork"},
+#endif
+#ifdef SYS_execve
+	{SYS_execve, "execve"},
+#endif
+#ifdef SYS_exit
+	{SYS_exit, "exit"},
+#endif
+#ifdef SYS_wait4
+	{SYS_wait4, "wait4"},
+#endif
+#ifdef SYS_kill
+	{SYS_kill, "kill"},
+#endif
+#ifdef SYS_uname
+	{SYS_uname, "uname"},
+#endif
+#ifdef SYS_fcntl
+	{SYS_fcntl, "fcntl"},
+#endif
+#ifdef SYS_flock
+	{SYS_flock, "flock"},
+#endif
+#ifdef SYS_fsync
+	{SYS_fsync, "fsync"},
+#endif
+#ifdef SYS_fdatasync
+	{SYS_fdatasync, "fdatasync"},
+#endif
+#ifdef SYS_truncate
+	{SYS_truncate, "truncate"},
+#endif
+#ifdef SYS_ftruncate
+	{SYS_ftruncate, "ftruncate"},
+#endif
+#ifdef SYS_getdents
+	{SYS_getdents, "getdents"},
+#endif
+#ifdef SYS_getcwd
+	{SYS_getcwd, "getcwd"},
+#endif
+#ifdef SYS_chdir
+	{SYS_chdir, "chdir"},
+#endif
+#ifdef SYS_rename
+	{SYS_rename, "rename"},
+#endif
+#ifdef SYS_mkdir
+	{SYS_mkdir, "mkdir"},
+#endif
+#ifdef SYS_rmdir
+	{SYS_rmdir, "rmdir"},
+#endif
+#ifdef SYS_unlink
+	{SYS_unlink, "unlink"},
+#endif
+#ifdef SYS_readlink
+	{SYS_readlink, "readlink"},
+#endif
+#ifdef SYS_chmod
+	{SYS_chmod, "chmod"},
+#endif
+#ifdef SYS_umask
+	{SYS_umask, "umask"},
+#endif
+#ifdef SYS_gettimeofday
+	{SYS_gettimeofday, "gettimeofday"},
+#endif
+#ifdef SYS_getrlimit
+	{SYS_getrlimit, "getrlimit"},
+#endif
+#ifdef SYS_getrusage
+	{SYS_getrusage, "getrusage"},
+#endif
+#ifdef SYS_sysinfo
+	{SYS_sysinfo, "sysinfo"},
+#endif
+#ifdef SYS_times
+	{SYS_times, "times"},
+#endif
+#ifdef SYS_getuid
+	{SYS_getuid, "getuid"},
+#endif
+#ifdef SYS_getgid
+	{SYS_getgid, "getgid"},
+#endif
+#ifdef SYS_setuid
+	{SYS_setuid, "setuid"},
+#endif
+#ifdef SYS_setgid
+	{SYS_setgid, "setgid"},
+#endif
+#ifdef SYS_geteuid
+	{SYS_geteuid, "geteuid"},
+#endif
+#ifdef SYS_getegid
+	{SYS_getegid, "getegid"},
+#endif
+#ifdef SYS_getppid
+	{SYS_getppid, "getppid"},
+#endif
+#ifdef SYS_getpgrp
+	{SYS_getpgrp, "getpgrp"},
+#endif
+#ifdef SYS_setsid
+	{SYS_setsid, "setsid"},
+#endif
+#ifdef SYS_sigaltstack
+	{SYS_sigaltstack, "sigaltstack"},
+#endif
+#ifdef SYS_arch_prctl
+	{SYS_arch_prctl, "arch_prctl"},
+#endif
+#ifdef SYS_prctl
+	{SYS_prctl, "prctl"},
+#endif
+#ifdef SYS_gettid
+	{SYS_gettid, "gettid"},
+#endif
+#ifdef SYS_futex
+	{SYS_futex, "futex"},
+#endif
+#ifdef SYS_sched_getaffinity
+	{SYS_sched_getaffinity, "sched_getaffinity"},
+#endif
+#ifdef SYS_set_tid_address
+	{SYS_set_tid_address, "set_tid_address"},
+#endif
+#ifdef SYS_getdents64
+	{SYS_getdents64, "getdents64"},
+#endif
+#ifdef SYS_clock_gettime
+	{SYS_clock_gettime, "clock_gettime"},
+#endif
+#ifdef SYS_clock_nanosleep
+	{SYS_clock_nanosleep, "clock_nanosleep"},
+#endif
+#ifdef SYS_exit_group
+	{SYS_exit_group, "exit_group"},
+#endif
+#ifdef SYS_tgkill
+	{SYS_tgkill, "tgkill"},
+#endif
+#ifdef SYS_openat
+	{SYS_openat, "openat"},
+#endif
+#ifdef SYS_mkdirat
+	{SYS_mkdirat, "mkdirat"},
+#endif
+#ifdef SYS_newfstatat
+	{SYS_newfstatat, "newfstatat"},
+#endif
+#ifdef SYS_fstatat
+	{SYS_fstatat, "fstatat"},
+#endif
+#ifdef SYS_readlinkat
+	{SYS_readlinkat, "readlinkat"},
+#endif
+#ifdef SYS_unlinkat
+	{SYS_unlinkat, "unlinkat"},
+#endif
+#ifdef SYS_faccessat
+	{SYS_faccessat, "faccessat"},
+#endif
+#ifdef SYS_pselect6
+	{SYS_pselect6, "pselect6"},
+#endif
+#ifdef SYS_ppoll
+	{SYS_ppoll, "ppoll"},
+#endif
+#ifdef SYS_set_robust_list
+	{SYS_set_robust_list, "set_robust_list"},
+#endif
+#ifdef SYS_get_robust_list
+	{SYS_get_robust_list, "get_robust_list"},
+#endif
+#ifdef SYS_splice
+	{SYS_splice, "splice"},
+#endif
+#ifdef SYS_tee
+	{SYS_tee, "tee"},
+#endif
+#ifdef SYS_epoll_wait
+	{SYS_epoll_wait, "epoll_wait"},
+#endif
+#ifdef SYS_epoll_ctl
+	{SYS_epoll_ctl, "epoll_ctl"},
+#endif
+#ifdef SYS_epoll_pwait
+	{SYS_epoll_pwait, "epoll_pwait"},
+#endif
+#ifdef SYS_dup3
+	{SYS_dup3, "dup3"},
+#endif
+#ifdef SYS_pipe2
+	{SYS_pipe2, "pipe2"},
+#endif
+#ifdef SYS_prlimit64
+	{SYS_prlimit64, "prlimit64"},
+#endif
+#ifdef SYS_getrandom
+	{SYS_getrandom, "getrandom"},
+#endif
+#ifdef SYS_statx
+	{SYS_statx, "statx"},
+#endif
+#ifdef SYS_rseq
+	{SYS_rseq, "rseq"},
+#endif
+#ifdef SYS_clone3
+	{SYS_clone3, "clone3"},
+#endif
+#ifdef SYS_close_range
+	{SYS_close_range, "close_range"},
+#endif
+#ifdef SYS_faccessat2
+	{SYS_faccessat2, "faccessat2"},
+#endif
+#ifdef SYS_execveat
+	{SYS_execveat, "execveat"},
+#endif
+};
+
+char *syscall_name(int nr)
+{
+	static char unknown[32];
+	for (size_t i = 0; i < sizeof(syscall_names) / sizeof(syscall_names[0]); i++)
+	{
+		if (syscall_names[i].nr == nr)
+			return syscall_names[i].name;
+	}
+	snprintf(unknown, sizeof(unknown), "syscall_%d", nr);
+	return unknown;
+}
+
+// an exited child can no longer be traced, its exit status is still waiting
+int child_has_exited(pid_t pid)
+{
+	siginfo_t info = {0};
+	if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1)
+		return errno == ECHILD;
+	return info.si_pid == pid;
+}
+
+// Seize without stopping, then interrupt so the first ptrace-stop can switch
+// the child to syscall tracing. With the fork backend the child is still
+// parked before execv(), so the exec itself is profiled.
+void start_profile(child_t *c)
+{
+	c->profile = calloc(1, sizeof(syscall_profile_t));
+	if (c->profile == NULL)
+		return;
+	c->profile->current = -1;
+	if (ptrace(PTRACE_SEIZE, c->pid, NULL, (void *)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC)) == -1 ||
+		ptrace(PTRACE_INTERRUPT, c->pid, NULL, NULL) == -1)
+	{
+		// Backends other than fork return after the exec, so the child may be
+		// gone: ESRCH once reaped, EPERM while it is a zombie.
+		if (errno != ESRCH && !(errno == EPERM && child_has_exited(c->pid)))
+			perror("ptrace");
+		free(c->profile);
+		c->profile = NULL;
+	}
+}
+
+void record_syscall_stop(child_t *c)
+{
+	syscall_profile_t *prof = c->profile;
+	struct syscall_trace_info info;
+	long long now = now_ns();
+
+	if (ptrace(PTRACE_GET_SYSCALL_INFO, c->pid, (void *)sizeof(info), &info) <= 0)
+		return;
+
+	if (info.op == PTRACE_SYSCALL_INFO_ENTRY)
+	{
+		prof->current = info.entry.nr < MAX_SYSCALLS ? (int)info.entry.nr : -1;
+		prof->entry_ns = now;
+	}
+	else if (info.op == PTRACE_SYSCALL_INFO_EXIT && prof->current >= 0)
+	{
+		prof->calls[prof->current]++;
+		prof->time_ns[prof->current] += now - prof->entry_ns;
+		if (info.exit.is_error)
+			prof->errors[prof->current]++;
+		prof->current = -1;
+	}
+}
+
+int compare_syscall_time(const void *a, const void *b, void *arg)
+{
+	syscall_profile_t *prof = arg;
+	long long x = prof->time_ns[*(const int *)a], y = prof->time_ns[*(const int *)b];
+	return (x < y) - (x > y);
+}
+
+void print_profile(supervisor_t *sv, child_t *c)
+{
+	syscall_profile_t *prof = c->profile;
+	char prefix[32] = "";
+	if (sv->count > 1)
+		snprintf(prefix, sizeof(prefix), "[%d] ", c->pid);
+	int order[MAX_SYSCALLS], n = 0;
+	long long total_ns = 0, total_calls = 0, total_errors = 0;
+
+	// the child is gone with a call entered and never left: exit_group, or
+	// whatever call a signal killed it in. Count it, with no time or error.
+	if (prof->current >= 0)
+	{
+		prof->calls[prof->current]++;
+		prof->current = -1;
+	}
+	for (int i = 0; i < MAX_SYSCALLS; i++)
+	{
+		if (prof->calls[i] == 0)
+			continue;
+		order[n++] = i;
+		total_ns += prof->time_ns[i];
+		total_calls += prof->calls[i];
+		total_errors += prof->errors[i];
+	}
+	qsort_r(order, n, sizeof(int), compare_syscall_time, prof);
+
+	printf("%ssyscall profile:\n", prefix);
+	printf("%% time     seconds  usecs/call     calls    errors syscall\n");
+	printf("------ ----------- ----------- --------- --------- ----------------\n");
+	for (int i = 0; i < n; i++)
+	{
+		int nr = order[i];
+		char errors[24] = "";
+		if (prof->errors[nr])
+			snprintf(errors, sizeof(errors), "%lld", prof->errors[nr]);
+		printf("%6.2f %11.6f %11lld %9lld %9s %s\n",
+			   total_ns ? 100.0 * prof->time_ns[nr] / total_ns : 0.0, prof->time_ns[nr] / 1e9,
+			   prof->time_ns[nr] / 1000 / prof->calls[nr], prof->calls[nr], errors, syscall_name(nr));
+	}
+	printf("------ ----------- ----------- --------- --------- ----------------\n");
+	printf("100.00 %11.6f %11s %9lld %9lld total\n", total_ns / 1e9, "", total_calls, total_errors);
+}
+
+/* ------------------------- per-child resource usage ------------------------ */
+
+long perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+	return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+// With the fork backend the child is still parked before execv(), so the
+// counters start exactly at exec. The other backends return after the exec,
+// so counting starts when the supervisor attaches and a child that already
+// exited reports no counters. A kernel that refuses (perf_event_paranoid,
+// seccomp, no CONFIG_PERF_EVENTS) disables counters for the rest of the run.
+void open_perf_counters(supervisor_t *sv, child_t *c, int before_exec)
+{
+	for (int i = 0; i < PERF_COUNTERS; i++)
+		c->perf_fd[i] = -1;
+	if (!sv->stats || !perf_available)
+		return;
+
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = perf_counters[i].config;
+		attr.inherit = 1;
+		attr.disabled = before_exec;
+		attr.enable_on_exec = before_exec;
+		c->perf_fd[i] = perf_event_open(&attr, c->pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		if (c->perf_fd[i] == -1 && (errno == EACCES || errno == EPERM))
+		{
+			// unprivileged callers may still count user-space activity
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			c->perf_fd[i] = perf_event_open(&attr, c->pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		}
+		if (c->perf_fd[i] == -1 && errno != ESRCH)
+		{
+			perf_available = 0;
+			break;
+		}
+	}
+}
+
+// returns -1 for a counter that is not available
+long long read_perf_counter(child_t *c, int i)
+{
+	unsigned long long value;
+	if (c->perf_fd[i] < 0 || read(c->perf_fd[i], &value, sizeof(value)) != sizeof(value))
+		return -1;
+	return (long long)value;
+}
+
+void close_perf_counters(child_t *c)
+{
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		if (c->perf_fd[i] >= 0)
+			close(c->perf_fd[i]);
+		c->perf_fd[i] = -1;
+	}
+}
+
+long long timeval_us(struct timeval *tv)
+{
+	return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+// as a JSON string literal; a program path may hold quotes, backslashes or
+// control characters
+void write_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++)
+	{
+		unsigned char ch = *s;
+		if (ch == '"' || ch == '\\')
+			fprintf(f, "\\%c", ch);
+		else if (ch < 0x20)
+			fprintf(f, "\\u%04x", ch);
+		else
+			fputc(ch, f);
+	}
+	fputc('"', f);
+}
+
+// Records always go to a file: stdout carries program1's messages and the
+// children's own output, which would corrupt them.
+void open_stats(supervisor_t *sv, char *path)
+{
+	// CSV appends so runs accumulate into one trend file
+	sv->stats = fopen(path, sv->stats_format == STATS_CSV ? "a" : "w");
+	if (sv->stats == NULL)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	if (sv->stats_format == STATS_JSON)
+	{
+		fprintf(sv->stats, "{\"program\": ");
+		write_json_string(sv->stats, sv->program);
+		fprintf(sv->stats, ", \"backend\": ");
+		write_json_string(sv->stats, sv->backend);
+		fprintf(sv->stats, ", \"time\": %ld, \"children\": [", (long)time(NULL));
+	}
+	else if (ftell(sv->stats) <= 0)
+	{
+		fprintf(sv->stats, "time,program,backend,pid,result,code,signal,wall_us,utime_us,stime_us,"
+						   "maxrss_kb,minflt,majflt,nvcsw,nivcsw");
+		for (int i = 0; i < PERF_COUNTERS; i++)
+			fprintf(sv->stats, ",%s", perf_counters[i].name);
+		fprintf(sv->stats, "\n");
+	}
+}
+
+void close_stats(supervisor_t *sv)
+{
+	if (sv->stats == NULL)
+		return;
+	if (sv->stats_format == STATS_JSON)
+		fprintf(sv->stats, "\n]}\n");
+	fclose(sv->stats);
+	sv->stats = NULL;
+}
+
+void write_stats(supervisor_t *sv, child_t *c)
+{
+	char *result = "exited";
+	int code = 0;
+	char *signal_name = "";
+	if (WIFSIGNALED(c->status))
+	{
+		result = c->timeout ? "timeout" : "signaled";
+		code = WTERMSIG(c->status);
+		signal_name = map_status(code);
+	}
+	else if (WIFSTOPPED(c->status))
+	{
+		result = "stopped";
+		code = WSTOPSIG(c->status);
+		signal_name = map_status(code);
+	}
+	else
+	{
+		code = WEXITSTATUS(c->status);
+	}
+
+	long long counters[PERF_COUNTERS];
+	for (int i = 0; i < PERF_COUNTERS; i++)
+		counters[i] = read_perf_counter(c, i);
+
+	if (sv->stats_format == STATS_JSON)
+	{
+		fprintf(sv->stats,
+				"%s\n  {\"pid\": %d, \"result\": \"%s\", \"code\": %d, \"signal\": \"%s\", "
+				"\"wall_us\": %lld, \"utime_us\": %lld, \"stime_us\": %lld, \"maxrss_kb\": %ld, "
+				"\"minflt\": %ld, \"majflt\": %ld, \"nvcsw\": %ld, \"nivcsw\": %ld",
+				sv->stats_rows ? "," : "", c->pid, result, code, signal_name,
+				(c->end_ns - c->start_ns) / 1000, timeval_us(&c->ru.ru_utime), timeval_us(&c->ru.ru_stime),
+				c->ru.ru_maxrss, c->ru.ru_minflt, c->ru.ru_majflt, c->ru.ru_nvcsw, c->ru.ru_nivcsw);
+		for (int i = 0; i < PERF_COUNTERS; i++)
+		{
+			if (counters[i] < 0)
+				fprintf(sv->stats, ", \"%s\": null", perf_counters[i].name);
+			else
+				fprintf(sv->stats, ", \"%s\": %lld", perf_counters[i].name, counters[i]);
+		}
+		fprintf(sv->stats, "}");
+	}
+	else
+	{
+		fprintf(sv->stats, "%ld,%s,%s,%d,%s,%d,%s,%lld,%lld,%lld,%ld,%ld,%ld,%ld,%ld",
+				(long)time(NULL), sv->program, sv->backend, c->pid, result, code, signal_name,
+				(c->end_ns - c->start_ns) / 1000, timeval_us(&c->ru.ru_utime), timeval_us(&c->ru.ru_stime),
+				c->ru.ru_maxrss, c->ru.ru_minflt, c->ru.ru_majflt, c->ru.ru_nvcsw, c->ru.ru_nivcsw);
+		for (int i = 0; i < PERF_COUNTERS; i++)
+		{
+			if (counters[i] < 0)
+				fprintf(sv->stats, ",");
+			else
+				fprintf(sv->stats, ",%lld", counters[i]);
+		}
+		fprintf(sv->stats, "\n");
+	}
+	sv->stats_rows++;
+}
+
+/* ------------------------------- supervisor ------------------------------- */
+
+int pidfd_open(pid_t pid, unsigned int flags)
+{
+	return syscall(SYS_pidfd_open, pid, flags);
+}
+
+// a pidfd cannot hit a recycled pid, unlike kill()
+void signal_child(child_t *c, int sig)
+{
+	if (c->pidfd < 0 || syscall(SYS_pidfd_send_signal, c->pidfd, sig, NULL, 0) == -1)
+		kill(c->pid, sig);
+}
+
+void register_child(supervisor_t *sv, int index)
+{
+	int slot = sv->children[index].pid & sv->pid_mask;
+	// a recycled pid simply takes over the slot of its reaped predecessor
+	while (sv->pid_slots[slot] && sv->children[sv->pid_slots[slot] - 1].pid != sv->children[index].pid)
+		slot = (slot + 1) & sv->pid_mask;
+	sv->pid_slots[slot] = index + 1;
+}
+
+child_t *find_child(supervisor_t *sv, pid_t pid)
+{
+	int slot = pid & sv->pid_mask;
+	while (sv->pid_slots[slot])
+	{
+		child_t *c = &sv->children[sv->pid_slots[slot] - 1];
+		if (c->pid == pid)
+			return c;
+		slot = (slot + 1) & sv->pid_mask;
+	}
+	return NULL;
+}
+
+void finish_child(supervisor_t *sv, child_t *c)
+{
+	c->end_ns = now_ns();
+	// Store what the child wrote before its stats. The pipes stay open until
+	// EOF: a grandchild it left behind may hold them and write more.
+	for (int s = 0; s < 2; s++)
+	{
+		if (c->out_fd[s] >= 0)
+			drain_output(sv, c, s);
+	}
+	if (sv->stats)
+		write_stats(sv, c);
+	close_perf_counters(c);
+	if (c->profile)
+	{
+		print_profile(sv, c);
+		if (c->state == CHILD_STOPPED)
+			ptrace(PTRACE_DETACH, c->pid, NULL, NULL); // leave it stopped, untraced
+		free(c->profile);
+		c->profile = NULL;
+	}
+	if (c->pidfd >= 0)
+		close(c->pidfd); // also drops it from the epoll set
+	c->pidfd = -1;
+	c->state = CHILD_DONE;
+	sv->live--;
+}
+
+void report_status(supervisor_t *sv, child_t *c, int status, struct rusage *ru)
+{
+	if (sv->sigchld_unreported)
+	{
+		printf("Parent process receives SIGCHLD signal\n");
+		sv->sigchld_unreported = 0;
+	}
+	c->status = status;
+	if (ru)
+		c->ru = *ru;
+
+	/* check child process'  termination status */
+	char prefix[32] = "";
+	if (sv->count > 1)
+		snprintf(prefix, sizeof(prefix), "[%d] ", c->pid);
+
+	if (c->timeout && (WIFEXITED(status) || WIFSIGNALED(status)))
+	{
+		if (WIFSIGNALED(status))
+			printf("%schild process timed out (%s limit), terminated by %s\n", prefix,
+				   timeout_names[c->timeout], map_status(WTERMSIG(status)));
+		else
+			printf("%schild process timed out (%s limit), exited with STATUS = %d\n", prefix,
+				   timeout_names[c->timeout], WEXITSTATUS(status));
+		sv->timed_out++;
+		finish_child(sv, c);
+	}
+	else if (WIFEXITED(status))
+	{
+		printf("%sNormal termination with EXIT STATUS = %d\n", prefix, WEXITSTATUS(status));
+		sv->exited++;
+		finish_child(sv, c);
+	}
+	else if (WIFSIGNALED(status))
+	{
+		char *status_str = map_status(WTERMSIG(status));
+		if (status_str == NULL)
+			status_str = "UNKNOWN";
+		printf("%schild process get %s signal\n", prefix, status_str);
+		sv->signaled++;
+		finish_child(sv, c);
+	}
+	else if (WIFSTOPPED(status))
+	{
+		char *status_str = map_status(WSTOPSIG(status));
+		if (status_str == NULL)
+			status_str = "UNKNOWN";
+		printf("%schild process get %s signal\n", prefix, status_str);
+		sv->stopped++;
+		c->state = CHILD_STOPPED;
+		if (!sv->follow)
+			finish_child(sv, c); // stop ends supervision, the child stays stopped
+	}
+	else if (WIFCONTINUED(status))
+	{
+		printf("%schild process continued\n", prefix);
+		c->state = CHILD_RUNNING;
+	}
+}
+
+// pidfd readiness means the child exited; reap exactly that child unless
+// the SIGCHLD batch earlier in this wakeup already did
+void handle_child_exit(supervisor_t *sv, child_t *c)
+{
+	int status;
+	struct rusage ru;
+	if (c->state == CHILD_DONE)
+		return;
+	if (wait4(c->pid, &status, WNOHANG, &ru) > 0)
+		report_status(sv, c, status, &ru);
+}
+
+// Every ptrace-stop of a profiled child arrives through wait4(). Syscall
+// stops feed the profile, group-stops are what an untraced child would have
+// reported as WIFSTOPPED, and everything else is resumed, forwarding signals.
+void handle_trace_stop(supervisor_t *sv, child_t *c, int status)
+{
+	int sig = WSTOPSIG(status), event = status >> 16, inject = 0;
+
+	if (sig == (SIGTRAP | 0x80))
+		record_syscall_stop(c);
+	else if (event == PTRACE_EVENT_STOP && (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU))
+	{
+		report_status(sv, c, status, NULL);
+		// stay in group-stop but keep reporting, so SIGCONT is noticed
+		if (c->state == CHILD_STOPPED)
+			ptrace(PTRACE_LISTEN, c->pid, NULL, NULL);
+		return;
+	}
+	else if (event == PTRACE_EVENT_STOP)
+	{
+		// PTRACE_INTERRUPT or the end of a group-stop
+		if (c->state == CHILD_STOPPED)
+			report_status(sv, c, 0xffff, NULL);
+	}
+	else if (event == 0)
+		inject = sig; // signal-delivery-stop
+	ptrace(PTRACE_SYSCALL, c->pid, NULL, (void *)(long)inject);
+}
+
+// Standard signals do not queue, so one pending SIGCHLD may stand for many
+// children. Drain the signalfd, then collect every waitable event in a single
+// batch of non-blocking wait4() calls, which also return each child's rusage.
+// This covers stop and continue too, which pidfds do not report.
+void handle_sigchld(supervisor_t *sv)
+{
+	struct signalfd_siginfo buf[64];
+	int pending = 0;
+	while (read(sv->sigfd, buf, sizeof(buf)) > 0)
+		pending = 1;
+	if (!pending)
+		return;
+	// ptrace-stops raise SIGCHLD too, announce only what gets reported
+	sv->sigchld_unreported = sv->count == 1;
+
+	while (1)
+	{
+		int status;
+		struct rusage ru;
+		pid_t pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru);
+		if (pid <= 0)
+			break;
+
+		child_t *c = find_child(sv, pid);
+		if (c == NULL || c->state == CHILD_DONE)
+			continue;
+		if (c->profile && WIFSTOPPED(status))
+			handle_trace_stop(sv, c, status);
+		else if (!WIFCONTINUED(status) || c->state == CHILD_STOPPED)
+			report_status(sv, c, status, WIFCONTINUED(status) ? NULL : &ru);
+	}
+}
+
+/* -------------------------------- timeouts -------------------------------- */
+
+// First step of the escalation: ask politely, then SIGKILL after the grace
+// period. A stopped child would never see SIGTERM, so it is continued too.
+void expire_child(supervisor_t *sv, child_t *c, enum timeout_reason reason, long long now)
+{
+	char prefix[32] = "";
+	if (sv->count > 1)
+		snprintf(prefix, sizeof(prefix), "[%d] ", c->pid);
+	printf("%schild process exceeded its %s limit, sending SIGTERM\n", prefix, timeout_names[reason]);
+
+	c->timeout = reason;
+	c->kill_at_ns = now + sv->grace_ns;
+	signal_child(c, SIGTERM);
+	if (c->state == CHILD_STOPPED)
+		signal_child(c, SIGCONT);
+	sv->kill_queue[sv->kill_tail++] = c - sv->children;
+}
+
+// sample ten times per limit, but no more often than every 10ms
+long long cpu_check_interval(supervisor_t *sv)
+{
+	long long tick = sv->cpu_limit_ns / 10;
+	return tick < 10000000LL ? 10000000LL : tick;
+}
+
+long long child_cpu_ns(child_t *c)
+{
+	struct timespec ts;
+	if (clock_gettime(c->cpu_clock, &ts) == -1)
+		return 0;
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Every child shares the same limits, so wall deadlines fire in launch order
+// and SIGKILL deadlines in SIGTERM order: both are plain FIFO queues. CPU
+// time has no timerfd clock and is sampled on a periodic tick instead.
+void handle_timers(supervisor_t *sv)
+{
+	unsigned long long expirations;
+	read(sv->timerfd, &expirations, sizeof(expirations));
+	long long now = now_ns();
+
+	while (sv->kill_head < sv->kill_tail)
+	{
+		child_t *c = &sv->children[sv->kill_queue[sv->kill_head]];
+		if (c->state != CHILD_DONE && c->kill_at_ns > now)
+			break;
+		if (c->state != CHILD_DONE)
+		{
+			if (sv->count > 1)
+				printf("[%d] ", c->pid);
+			printf("child process ignored SIGTERM for the grace period, sending SIGKILL\n");
+			signal_child(c, SIGKILL);
+		}
+		sv->kill_head++;
+	}
+
+	while (sv->wall_limit_ns && sv->wall_head < sv->launched)
+	{
+		child_t *c = &sv->children[sv->wall_head];
+		if (c->state != CHILD_DONE && !c->timeout)
+		{
+			if (c->start_ns + sv->wall_limit_ns > now)
+				break;
+			expire_child(sv, c, TIMEOUT_WALL, now);
+		}
+		sv->wall_head++;
+	}
+
+	if (sv->cpu_limit_ns && now >= sv->next_cpu_check_ns)
+	{
+		for (int i = 0; i < sv->launched; i++)
+		{
+			child_t *c = &sv->children[i];
+			if (c->state != CHILD_DONE && !c->timeout && child_cpu_ns(c) >= sv->cpu_limit_ns)
+				expire_child(sv, c, TIMEOUT_CPU, now);
+		}
+		sv->next_cpu_check_ns = now + cpu_check_interval(sv);
+	}
+}
+
+void arm_timer(supervisor_t *sv)
+{
+	long long next = 0;
+
+	if (sv->kill_head < sv->kill_tail)
+		next = sv->children[sv->kill_queue[sv->kill_head]].kill_at_ns;
+	if (sv->wall_limit_ns)
+	{
+		while (sv->wall_head < sv->launched &&
+			   (sv->children[sv->wall_head].state == CHILD_DONE || sv->children[sv->wall_head].timeout))
+			sv->wall_head++;
+		if (sv->wall_head < sv->launched)
+		{
+			long long deadline = sv->children[sv->wall_head].start_ns + sv->wall_limit_ns;
+			if (next == 0 || deadline < next)
+				next = deadline;
+		}
+	}
+	if (sv->cpu_limit_ns && (next == 0 || sv->next_cpu_check_ns < next))
+		next = sv->next_cpu_check_ns;
+
+	// an all-zero it_value disarms the timer
+	struct itimerspec its = {0};
+	its.it_value.tv_sec = next / 1000000000LL;
+	its.it_value.tv_nsec = next % 1000000000LL;
+	timerfd_settime(sv->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+long long parse_seconds(const char *arg)
+{
+	char *end;
+	double seconds = strtod(arg, &end);
+	if (*end != '\0' || seconds <= 0)
+		return -1;
+	return (long long)(seconds * 1e9);
+}
+
+int launch_next(supervisor_t *sv, enum launch_backend backend, launch_request_t *req)
+{
+	int index = sv->launched;
+	child_t *c = &sv->children[index];
+
+	int pipes[2][2];
+	if (prepare_output(sv, c, req, pipes) == -1)
+	{
+		perror("pipe");
+		return -1;
+	}
+
+	int gate[2] = {-1, -1};
+	if (backend == BACKEND_FORK && ((sv->stats && perf_available) || sv->profile) && pipe2(gate, O_CLOEXEC) == 0)
+		req->gate_fd = gate[0];
+
+	c->start_ns = now_ns();
+	c->pid = launch_child(backend, req);
+	req->gate_fd = -1;
+	req->stdio[1] = req->stdio[2] = -1;
+	if (gate[0] >= 0)
+		close(gate[0]);
+	if (c->pid == -1)
+	{
+		perror(backend_names[backend]);
+		if (gate[1] >= 0)
+			close(gate[1]);
+		for (int s = 0; s < 2; s++)
+		{
+			if (pipes[s][0] >= 0)
+				close(pipes[s][0]);
+			if (pipes[s][1] >= 0)
+				close(pipes[s][1]);
+		}
+		return -1;
+	}
+	attach_output(sv, c, index, pipes);
+	sv->launched++;
+	sv->live++;
+	c->state = CHILD_RUNNING;
+	register_child(sv, index);
+	open_perf_counters(sv, c, gate[1] >= 0);
+	if (sv->profile)
+		start_profile(c);
+	if (sv->cpu_limit_ns && clock_getcpuclockid(c->pid, &c->cpu_clock) != 0)
+		c->cpu_clock = -1;
+	if (gate[1] >= 0)
+	{
+		// the child holds a copy of the write end too, so EOF never comes
+		write(gate[1], "g", 1);
+		close(gate[1]);
+	}
+
+	// Without a pidfd the child is still reaped by the SIGCHLD batch, it is
+	// only woken for a little later. ESRCH means it has already exited.
+	c->pidfd = req->pidfd >= 0 ? req->pidfd : pidfd_open(c->pid, 0);
+	if (c->pidfd == -1)
+	{
+		if (errno != ESRCH)
+			perror("pidfd_open");
+		return 0;
+	}
+	fcntl(c->pidfd, F_SETFD, FD_CLOEXEC);
+
+	struct epoll_event ev = {.events = EPOLLIN, .data.u64 = index + 1};
+	if (epoll_ctl(sv->epfd, EPOLL_CTL_ADD, c->pidfd, &ev) == -1)
+	{
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+// each child needs a pidfd, so allow as many descriptors as the hard limit
+void raise_fd_limit(void)
+{
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+/* --------------------------------- main ----------------------------------- */
+
+void usage(void)
+{
+	fprintf(stderr, "usage: program1 [-b fork|vfork|spawn|clone|zygote] [-n COUNT] [-j JOBS] [-f] [-p]\n");
+	fprintf(stderr, "                [-o STATS_FILE [-F csv|json]] [-t WALL_SEC] [-c CPU_SEC] [-g GRACE_SEC]\n");
+	fprintf(stderr, "                [-L LOG_DIR] [-l MERGED_LOG]\n");
+	fprintf(stderr, "                TEST_CASE [ARG...]\n");
+	fprintf(stderr, "       program1 bench [-b BACKEND|all] [-n ITERATIONS] [-m MB[,MB...]] TEST_CASE [ARG...]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return run_bench(argc - 1, argv + 1);
+
+	enum launch_backend backend = BACKEND_FORK;
+	supervisor_t sv = {.count = 1, .grace_ns = DEFAULT_GRACE_NS, .merged_fd = -1, .tee_pipe = {-1, -1}};
+	char *merged_path = NULL;
+	int jobs = 0;
+	char *stats_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "+b:n:j:fpF:o:t:c:g:L:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b':
+			if (parse_backend(optarg) == -1)
+				usage();
+			backend = parse_backend(optarg);
+			break;
+		case 'n':
+			sv.count = atoi(optarg);
+			if (sv.count <= 0)
+				usage();
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs <= 0)
+				usage();
+			break;
+		case 'f':
+			sv.follow = 1;
+			break;
+		case 'p':
+			sv.profile = 1;
+			break;
+		case 'F':
+			if (strcmp(optarg, "csv") == 0)
+				sv.stats_format = STATS_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				sv.stats_format = STATS_JSON;
+			else
+				usage();
+			break;
+		case 'o':
+			stats_path = optarg;
+			break;
+		case 't':
+			if ((sv.wall_limit_ns = parse_seconds(optarg)) == -1)
+				usage();
+			break;
+		case 'c':
+			if ((sv.cpu_limit_ns = parse_seconds(optarg)) == -1)
+				usage();
+			break;
+		case 'g':
+			if ((sv.grace_ns = parse_seconds(optarg)) == -1)
+				usage();
+			break;
+		case 'L':
+			sv.log_dir = optarg;
+			break;
+		case 'l':
+			merged_path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc)
+		usage();
+	if (jobs == 0 || jobs > sv.count)
+		jobs = sv.count;
+	sv.program = argv[optind];
+	sv.backend = backend_names[backend];
+	if (sv.stats_format != STATS_NONE && (stats_path == NULL || strcmp(stats_path, "-") == 0))
+	{
+		fprintf(stderr, "program1: -F needs -o FILE, stdout is shared with the test program\n");
+		exit(EXIT_FAILURE);
+	}
+	if (stats_path && sv.stats_format == STATS_NONE)
+	{
+		char *ext = strrchr(stats_path, '.');
+		sv.stats_format = ext && strcmp(ext, ".json") == 0 ? STATS_JSON : STATS_CSV;
+	}
+	if (backend == BACKEND_ZYGOTE && zygote_start(argv[optind], &argv[optind]) == -1)
+	{
+		perror("zygote");
+		exit(EXIT_FAILURE);
+	}
+	if (sv.stats_format != STATS_NONE)
+		open_stats(&sv, stats_path);
+	if (sv.log_dir && mkdir(sv.log_dir, 0755) == -1 && errno != EEXIST)
+	{
+		perror(sv.log_dir);
+		exit(EXIT_FAILURE);
+	}
+	if (merged_path)
+	{
+		sv.merged_fd = open(merged_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (sv.merged_fd == -1)
+		{
+			perror(merged_path);
+			exit(EXIT_FAILURE);
+		}
+		if (sv.log_dir && pipe2(sv.tee_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		{
+			perror("pipe");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	int slots = 2;
+	while (slots < sv.count * 2)
+		slots <<= 1;
+	sv.children = calloc(sv.count, sizeof(child_t));
+	sv.pid_slots = calloc(slots, sizeof(int));
+	sv.pid_mask = slots - 1;
+	sv.kill_queue = calloc(sv.count, sizeof(int));
+	if (!sv.children || !sv.pid_slots || !sv.kill_queue)
+	{
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	raise_fd_limit();
+
+	// block SIGCHLD before the first launch so no notification is lost
+	sigset_t child_mask, old_mask;
+	sigemptyset(&child_mask);
+	sigaddset(&child_mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &child_mask, &old_mask);
+
+	sv.epfd = epoll_create1(EPOLL_CLOEXEC);
+	sv.sigfd = signalfd(-1, &child_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sv.epfd == -1 || sv.sigfd == -1)
+	{
+		perror("epoll_create1/signalfd");
+		exit(EXIT_FAILURE);
+	}
+	struct epoll_event sig_ev = {.events = EPOLLIN, .data.u64 = EV_SIGCHLD};
+	epoll_ctl(sv.epfd, EPOLL_CTL_ADD, sv.sigfd, &sig_ev);
+
+	sv.timerfd = -1;
+	if (sv.wall_limit_ns || sv.cpu_limit_ns)
+	{
+		sv.follow = 1; // a stopped child still has to hit its deadline
+		sv.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (sv.timerfd == -1)
+		{
+			perror("timerfd_create");
+			exit(EXIT_FAILURE);
+		}
+		struct epoll_event timer_ev = {.events = EPOLLIN, .data.u64 = EV_TIMER};
+		epoll_ctl(sv.epfd, EPOLL_CTL_ADD, sv.timerfd, &timer_ev);
+		sv.next_cpu_check_ns = now_ns() + cpu_check_interval(&sv);
+	}
+
+	/* fork a child process */
+	printf("Process start to fork\n");
+	launch_request_t req = {
+		.path = argv[optind],
+		.argv = &argv[optind],
+		.stdio = {-1, -1, -1},
+		.sigmask = &old_mask,
+		.gate_fd = -1,
+		.exec_fd = -1,
+		.verbose = sv.count == 1};
+
+	while (sv.launched < jobs)
+	{
+		if (launch_next(&sv, backend, &req) == -1)
+			exit(EXIT_FAILURE);
+	}
+
+	printf("I'm the Parent Process, my pid = %d\n", getpid());
+	if (sv.count == 1 && backend != BACKEND_FORK)
+		printf("Child process %d launched via %s\n", sv.children[0].pid, backend_names[backend]);
+	if (backend == BACKEND_ZYGOTE)
+		printf("Zygote %d runs the test program in %s mode\n", zygote_pid, zygote_mode_names[zygote_mode]);
+
+	/* wait for child processes to terminate */
+	struct epoll_event events[MAX_EVENTS];
+	long long output_deadline = 0;
+	while (sv.live > 0 || sv.open_outputs > 0)
+	{
+		int timeout = output_linger_ms(&sv, &output_deadline);
+		if (timeout == 0)
+			break;
+		if (sv.timerfd >= 0)
+			arm_timer(&sv);
+
+		int n = epoll_wait(sv.epfd, events, MAX_EVENTS, timeout);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			printf("epoll_wait error\n");
+			exit(EXIT_FAILURE);
+		}
+
+		// drain SIGCHLD first to keep each child's events in order, and
+		// only then look at deadlines so no exited child gets signalled
+		int timer_fired = 0;
+		handle_sigchld(&sv);
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.u64 == EV_TIMER)
+				timer_fired = 1;
+			else if (events[i].data.u64 & EV_OUTPUT)
+				handle_output(&sv, events[i].data.u64, events[i].events);
+			else if (events[i].data.u64 != EV_SIGCHLD)
+				handle_child_exit(&sv, &sv.children[events[i].data.u64 - 1]);
+		}
+		if (timer_fired)
+			handle_timers(&sv);
+
+		while (sv.launched < sv.count && sv.live < jobs)
+		{
+			if (launch_next(&sv, backend, &req) == -1)
+				break;
+		}
+	}
+
+	if (sv.count > 1)
+		printf("%d children: %d exited normally, %d terminated by signal, %d stopped, %d timed out\n",
+			   sv.launched, sv.exited, sv.signaled, sv.stopped, sv.timed_out);
+	close_stats(&sv);
+	zygote_stop();
+	if (sv.merged_fd >= 0)
+		close(sv.merged_fd);
+	free(sv.children);
+	free(sv.pid_slots);
+	free(sv.kill_queue);
+	return 0;
+}
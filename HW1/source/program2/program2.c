@@ -9,15 +9,96 @@
 #include <linux/jiffies.h>
 #include <linux/kmod.h>
 #include <linux/fs.h>
+#include <linux/string.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+
+#define CREATE_TRACE_POINTS
+#include "program2_trace.h"
 
 MODULE_LICENSE("GPL");
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+#define kthread_complete_and_exit complete_and_exit
+#endif
+
 extern struct filename *getname_kernel(const char *filename);
 extern pid_t kernel_clone(struct kernel_clone_args *kargs);
 extern long kernel_execve(const char *filename, const char *const *argv, const char *const *envp);
 extern int kernel_wait(pid_t pid, int *stat);
 extern void putname(struct filename *name);
-extern void msleep(unsigned int msecs);
+
+// Programs to launch, e.g. insmod program2.ko programs=/tmp/test,/tmp/abort jobs=2.
+// The list is launched 'repeat' times with up to 'jobs' programs running at once.
+static char *programs[16] = {"/tmp/test"};
+static int nr_programs;
+module_param_array(programs, charp, &nr_programs, 0444);
+MODULE_PARM_DESC(programs, "comma separated executables to launch (default /tmp/test)");
+
+static int jobs = 1;
+module_param(jobs, int, 0444);
+MODULE_PARM_DESC(jobs, "number of programs running concurrently");
+
+static int repeat = 1;
+module_param(repeat, int, 0444);
+MODULE_PARM_DESC(repeat, "number of times the whole list is launched");
+
+static atomic_t next_launch = ATOMIC_INIT(0);
+static atomic_t finished_launches = ATOMIC_INIT(0);
+static int started_workers;
+static DECLARE_COMPLETION(workers_done); // completed once by each worker
+static u64 start_ns;
+
+// Last LAUNCH_RECORDS launches, shown in /sys/kernel/debug/program2/launches.
+// Writers claim a slot with one atomic increment and publish it by storing
+// its sequence number last; readers skip slots whose sequence changes while
+// they copy them. Two writers meet on a slot only when one lapped the ring,
+// so the per-slot lock they take is all but never contended.
+#define LAUNCH_RECORDS 256
+
+struct launch_record
+{
+	u64 seq; // index + 1 once published, 0 while being written
+	const char *path;
+	pid_t pid;
+	int status;
+	u64 clone_to_exec_ns;
+	u64 exec_to_exit_ns;
+};
+
+static struct launch_record launch_ring[LAUNCH_RECORDS];
+static spinlock_t ring_locks[LAUNCH_RECORDS];
+static atomic64_t ring_head = ATOMIC64_INIT(0);
+
+static atomic64_t nr_launched = ATOMIC64_INIT(0);
+static atomic64_t nr_exited = ATOMIC64_INIT(0);
+static atomic64_t nr_signaled = ATOMIC64_INIT(0);
+static atomic64_t nr_stopped = ATOMIC64_INIT(0);
+static atomic64_t nr_core_dumps = ATOMIC64_INIT(0);
+static atomic64_t nr_failed = ATOMIC64_INIT(0);
+static atomic64_t total_clone_to_exec_ns = ATOMIC64_INIT(0);
+static atomic64_t total_exec_to_exit_ns = ATOMIC64_INIT(0);
+
+static struct dentry *debugfs_dir;
+
+// One launch, shared between the kthread and the child it clones. The two
+// completions replace fixed sleeps: each side prints its pid, then hands over.
+struct launch
+{
+	const char *path;
+	struct completion child_ready;	// child printed its pid
+	struct completion parent_ready; // parent printed its pid, child may exec
+	u64 clone_ns;					// before kernel_clone()
+	u64 exec_ns;					// before kernel_execve(), written by the child
+	u64 exit_ns;					// kernel_wait() returned
+};
 
 char *map_status(int status)
 {
@@ -169,31 +250,38 @@ char *map_status(int status)
 	return status_str;
 }
 
-int my_exec(void)
+int my_exec(void *data)
 {
+	struct launch *launch = data;
+
 	// • Print out the process id for both parent and child process. (5 points)
 	pid_t pid = current->pid;
 	printk("[program2] : The child process has pid = %d\n", pid);
 
-	char *path = "/tmp/test";
-
-	msleep(20);
+	complete(&launch->child_ready);
+	wait_for_completion(&launch->parent_ready);
 
 	// • Within my_fork, fork a process to execute the test program. (10 points)
 	/* execute a test program in child process */
 	printk("[program2] : child process\n");
 
-	struct filename *filename = getname_kernel(path);
+	// the trace points are static keys, skip the clock reads when disabled
+	u64 getname_ns = trace_program2_getname_enabled() ? ktime_get_ns() : 0;
+	struct filename *filename = getname_kernel(launch->path);
+	if (getname_ns)
+		trace_program2_getname(pid, ktime_get_ns() - getname_ns, PTR_ERR_OR_ZERO(filename));
 	if (IS_ERR(filename))
 	{
 		printk(KERN_ERR "Failed to get filename\n");
 		return PTR_ERR(filename);
 	}
 
-	const char *argv[] = {"test", NULL};
+	const char *argv[] = {kbasename(launch->path), NULL};
 	const char *envp[] = {NULL};
 
+	launch->exec_ns = ktime_get_ns();
 	int return_code = kernel_execve(filename->name, argv, envp);
+	trace_program2_execve(pid, ktime_get_ns() - launch->exec_ns, return_code);
 
 	putname(filename);
 
@@ -203,25 +291,95 @@ int my_exec(void)
 	return return_code;
 }
 
-// implement fork function
-int my_fork(void *argc)
+void record_launch(struct launch *launch, pid_t pid, int status)
 {
-	printk("[program2] : module_init kthread start\n");
+	u64 index = atomic64_inc_return(&ring_head) - 1;
+	struct launch_record *rec = &launch_ring[index % LAUNCH_RECORDS];
+	u64 clone_to_exec_ns = launch->exec_ns ? launch->exec_ns - launch->clone_ns : 0;
+	u64 exec_to_exit_ns = launch->exec_ns ? launch->exit_ns - launch->exec_ns : 0;
 
-	// set default sigaction for current process
-	int i;
-	struct k_sigaction *k_action = &current->sighand->action[0];
-	for (i = 0; i < _NSIG; i++)
+	spin_lock(&ring_locks[index % LAUNCH_RECORDS]);
+	if (rec->seq <= index) // a newer launch that lapped this one keeps the slot
 	{
-		k_action->sa.sa_handler = SIG_DFL;
-		k_action->sa.sa_flags = 0;
-		k_action->sa.sa_restorer = NULL;
-		sigemptyset(&k_action->sa.sa_mask);
-		k_action++;
+		WRITE_ONCE(rec->seq, 0);
+		smp_wmb();
+		rec->path = launch->path;
+		rec->pid = pid;
+		rec->status = status;
+		rec->clone_to_exec_ns = clone_to_exec_ns;
+		rec->exec_to_exit_ns = exec_to_exit_ns;
+		smp_store_release(&rec->seq, index + 1);
+	}
+	spin_unlock(&ring_locks[index % LAUNCH_RECORDS]);
+
+	atomic64_inc(&nr_launched);
+	if ((status & 0x7f) == 0)
+		atomic64_inc(&nr_exited);
+	else if ((status & 0x7f) == 0x7f)
+		atomic64_inc(&nr_stopped);
+	else
+		atomic64_inc(&nr_signaled);
+	if (status & 0x80)
+		atomic64_inc(&nr_core_dumps);
+	atomic64_add(clone_to_exec_ns, &total_clone_to_exec_ns);
+	atomic64_add(exec_to_exit_ns, &total_exec_to_exit_ns);
+}
+
+static int launches_show(struct seq_file *m, void *v)
+{
+	u64 launched = atomic64_read(&nr_launched);
+	u64 head = atomic64_read(&ring_head);
+	u64 index = head > LAUNCH_RECORDS ? head - LAUNCH_RECORDS : 0;
+
+	seq_printf(m, "launched %llu exited %llu signaled %llu stopped %llu core_dumps %llu clone_failed %llu\n",
+			   launched, (u64)atomic64_read(&nr_exited), (u64)atomic64_read(&nr_signaled),
+			   (u64)atomic64_read(&nr_stopped), (u64)atomic64_read(&nr_core_dumps),
+			   (u64)atomic64_read(&nr_failed));
+	if (launched)
+		seq_printf(m, "mean clone_to_exec_ns %llu exec_to_exit_ns %llu\n",
+				   div64_u64(atomic64_read(&total_clone_to_exec_ns), launched),
+				   div64_u64(atomic64_read(&total_exec_to_exit_ns), launched));
+	seq_puts(m, "pid result code core clone_to_exec_ns exec_to_exit_ns program\n");
+
+	for (; index < head; index++)
+	{
+		struct launch_record *slot = &launch_ring[index % LAUNCH_RECORDS];
+		struct launch_record rec;
+		if (smp_load_acquire(&slot->seq) != index + 1)
+			continue; // still being written, or already overwritten
+		rec = *slot;
+		smp_rmb();
+		if (READ_ONCE(slot->seq) != index + 1)
+			continue;
+
+		char *result = "exited";
+		int code = (rec.status >> 8) & 0xff;
+		if ((rec.status & 0x7f) == 0x7f)
+			result = "stopped";
+		else if (rec.status & 0x7f)
+		{
+			result = "signaled";
+			code = rec.status & 0x7f;
+		}
+		seq_printf(m, "%d %s %d %d %llu %llu %s\n", rec.pid, result, code, !!(rec.status & 0x80),
+				   rec.clone_to_exec_ns, rec.exec_to_exit_ns, rec.path);
 	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(launches);
 
+// Launch one program and wait for it. When several launches run at once
+// every message that does not already name a pid is prefixed with it.
+int launch_program(const char *path, int total)
+{
 	// • Within my_fork, fork a process to execute the test program. (10 points)
 	/* fork a process using kernel_clone or kernel_thread */
+	struct launch launch = {.path = path};
+	init_completion(&launch.child_ready);
+	init_completion(&launch.parent_ready);
+
+	// a kernel thread's child starts in the function passed as stack, with
+	// stack_size as its argument
 	struct kernel_clone_args clone_args = {
 		.flags = SIGCHLD,
 		.pidfd = NULL,
@@ -229,77 +387,129 @@ int my_fork(void *argc)
 		.parent_tid = NULL,
 		.exit_signal = SIGCHLD,
 		.stack = (unsigned long)&my_exec,
-		.stack_size = 0,
+		.stack_size = (unsigned long)&launch,
 		.tls = 0};
 
+	launch.clone_ns = ktime_get_ns();
 	int pid = kernel_clone(&clone_args);
+	trace_program2_clone(current->pid, ktime_get_ns() - launch.clone_ns, pid);
 
 	if (pid < 0)
 	{
 		printk("Error forking process\n");
+		atomic64_inc(&nr_failed);
 		return -1;
 	}
-	else
-	{
-		// • The parent process will wait until child process terminates. (10 points)
-		/* wait until child process terminates */
 
-		msleep(10);
+	// • The parent process will wait until child process terminates. (10 points)
+	/* wait until child process terminates */
+
+	wait_for_completion(&launch.child_ready);
+
+	// • Print out the process id for both parent and child process. (5 points)
+	printk("[program2] : This is the parent process, pid = %d\n", current->pid);
+
+	complete(&launch.parent_ready);
 
-		// • Print out the process id for both parent and child process. (5 points)
-		printk("[program2] : This is the parent process, pid = %d\n", current->pid);
+	int status = 666;
+	u64 wait_ns = ktime_get_ns();
+	kernel_wait(pid, &status);
+	launch.exit_ns = ktime_get_ns();
+	trace_program2_wait(pid, launch.exit_ns - wait_ns, status);
+	record_launch(&launch, pid, status);
 
-		msleep(30);
+	char prefix[32] = "";
+	if (total > 1)
+		snprintf(prefix, sizeof(prefix), "[%d] ", pid);
 
-		int status = 666;
-		kernel_wait(pid, &status);
+	// • Within this test program, it will raise signal. The signal could be caught
+	//   and related message should be printed out in kernel log. (10 points)
 
-		// • Within this test program, it will raise signal. The signal could be caught
-		//   and related message should be printed out in kernel log. (10 points)
+	if ((status & 0x7f) == 0)
+	{
+		// normal termination
+		int exit_code = (((status) & 0xff00) >> 8);
+		char *status_str = map_status(exit_code);
+		if (status_str == NULL)
+			status_str = "UNKNOWN";
+		printk("[program2] : %sget %s signal\n", prefix, status_str);
+		printk("[program2] : %schild process terminated", prefix);
+		printk("[program2] : %sThe return signal is %d\n", prefix, exit_code);
+	}
 
-		if ((status & 0x7f) == 0)
+	if (status & 0x7f)
+	{
+		// terminated by signal
+		int signal_number = status & 0x7f;
+		char *status_str = map_status(signal_number);
+		if (status_str == NULL)
+			status_str = "UNKNOWN";
+		printk("[program2] : %sget %s signal\n", prefix, status_str);
+
+		if (status & 0x80)
 		{
-			// normal termination
-			int exit_code = (((status) & 0xff00) >> 8);
-			char *status_str = map_status(exit_code);
-			if (status_str == NULL)
-				status_str = "UNKNOWN";
-			printk("[program2] : get %s signal\n", status_str);
-			printk("[program2] : child process terminated");
-			printk("[program2] : The return signal is %d\n", exit_code);
+			printk("[program2] : %sChild produced a core dump", prefix);
 		}
 
-		if (status & 0x7f)
-		{
-			// terminated by signal
-			int signal_number = status & 0x7f;
-			char *status_str = map_status(signal_number);
-			if (status_str == NULL)
-				status_str = "UNKNOWN";
-			printk("[program2] : get %s signal\n", status_str);
-
-			if (status & 0x80)
-			{
-				printk("[program2] : Child produced a core dump");
-			}
+		printk("[program2] : %schild process terminated", prefix);
+		printk("[program2] : %sThe return signal is %d\n", prefix, signal_number);
+	}
 
-			printk("[program2] : child process terminated");
-			printk("[program2] : The return signal is %d\n", signal_number);
-		}
+	if ((status & 0x7f) == 0x7f)
+	{
+		// stopped by signal
+		int stop_signal = (status >> 8) & 0xff;
+		char *status_str = map_status(stop_signal);
+		if (status_str == NULL)
+			status_str = "UNKNOWN";
+		printk("[program2] : %sget %s signal\n", prefix, status_str);
+		printk("[program2] : %sThe return signal is %d\n", prefix, stop_signal);
+	}
+
+	// exec_ns stays 0 if the child failed before kernel_execve()
+	if (launch.exec_ns)
+		printk("[program2] : %sclone-to-exec %llu ns, exec-to-exit %llu ns\n", prefix,
+			   launch.exec_ns - launch.clone_ns, launch.exit_ns - launch.exec_ns);
+
+	return 0;
+}
+
+// implement fork function
+// Every my_fork kthread pulls the next launch from a shared counter, so
+// 'jobs' threads keep up to 'jobs' programs running and each one reaps its
+// own child as soon as it finishes.
+int my_fork(void *argc)
+{
+	printk("[program2] : module_init kthread start\n");
+
+	// set default sigaction for current process
+	int i;
+	struct k_sigaction *k_action = &current->sighand->action[0];
+	for (i = 0; i < _NSIG; i++)
+	{
+		k_action->sa.sa_handler = SIG_DFL;
+		k_action->sa.sa_flags = 0;
+		k_action->sa.sa_restorer = NULL;
+		sigemptyset(&k_action->sa.sa_mask);
+		k_action++;
+	}
 
-		if ((status & 0x7f) == 0x7f)
+	int total = nr_programs * repeat;
+	int next;
+	while ((next = atomic_inc_return(&next_launch) - 1) < total)
+	{
+		launch_program(programs[next % nr_programs], total);
+		if (atomic_inc_return(&finished_launches) == total && total > 1)
 		{
-			// stopped by signal
-			int stop_signal = (status >> 8) & 0xff;
-			char *status_str = map_status(stop_signal);
-			if (status_str == NULL)
-				status_str = "UNKNOWN";
-			printk("[program2] : get %s signal\n", status_str);
-			printk("[program2] : The return signal is %d\n", stop_signal);
+			u64 elapsed_ns = ktime_get_ns() - start_ns;
+			printk("[program2] : %d launches with %d jobs in %llu ns, %llu launches/s\n", total, jobs,
+				   elapsed_ns, elapsed_ns ? div64_u64((u64)total * NSEC_PER_SEC, elapsed_ns) : 0);
 		}
 	}
 
-	return 0;
+	// complete from the kernel's exit path: after a plain complete() this
+	// thread would still run module code that rmmod may already have freed
+	kthread_complete_and_exit(&workers_done, 0);
 }
 
 static int __init program2_init(void)
@@ -308,20 +518,44 @@ static int __init program2_init(void)
 	printk("[program2] : Module_init\n");
 
 	/* write your code here */
+	if (nr_programs == 0)
+		nr_programs = 1; // keeps the default "/tmp/test"
+	if (jobs < 1 || repeat < 1)
+		return -EINVAL;
+	if (jobs > nr_programs * repeat)
+		jobs = nr_programs * repeat;
+	start_ns = ktime_get_ns();
+	int i;
+	for (i = 0; i < LAUNCH_RECORDS; i++)
+		spin_lock_init(&ring_locks[i]);
+
+	// launch records are optional, go on without debugfs
+	debugfs_dir = debugfs_create_dir("program2", NULL);
+	debugfs_create_file("launches", 0444, debugfs_dir, NULL, &launches_fops);
 
 	// • When program2.ko being initialized, create a kernel thread and run my_fork function. (10 points)
 	/* create a kernel thread to run my_fork */
-	struct task_struct *thread = kthread_create(&my_fork, NULL, "my_fork");
-	printk("[program2] : module_init create kthread start\n");
-
-	if (IS_ERR(thread))
+	for (i = 0; i < jobs; i++)
 	{
-		printk("Error creating thread\n");
-		return PTR_ERR(thread);
-	}
-	else
-	{
-		wake_up_process(thread);
+		struct task_struct *thread = kthread_create(&my_fork, NULL, "my_fork/%d", i);
+		printk("[program2] : module_init create kthread start\n");
+
+		if (IS_ERR(thread))
+		{
+			printk("Error creating thread\n");
+			// the threads already started finish the whole list
+			if (i == 0)
+			{
+				debugfs_remove_recursive(debugfs_dir);
+				return PTR_ERR(thread);
+			}
+			break;
+		}
+		else
+		{
+			started_workers++;
+			wake_up_process(thread);
+		}
 	}
 
 	return 0;
@@ -329,6 +563,11 @@ static int __init program2_init(void)
 
 static void __exit program2_exit(void)
 {
+	// the kthreads run module code until the last launch is reaped
+	int i;
+	for (i = 0; i < started_workers; i++)
+		wait_for_completion(&workers_done);
+	debugfs_remove_recursive(debugfs_dir);
 	printk("[program2] : Module_exit\n");
 }
 
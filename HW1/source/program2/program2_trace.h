@@ -0,0 +1,60 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM program2
+
+#if !defined(_PROGRAM2_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PROGRAM2_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// One event per launch phase, so trace-cmd/perf can break launch latency down:
+//   trace-cmd record -e program2 && trace-cmd report
+//   perf stat -e 'program2:*' -a
+DECLARE_EVENT_CLASS(program2_phase,
+
+	TP_PROTO(pid_t pid, u64 duration_ns, long ret),
+
+	TP_ARGS(pid, duration_ns, ret),
+
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(u64, duration_ns)
+		__field(long, ret)
+	),
+
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->duration_ns = duration_ns;
+		__entry->ret = ret;
+	),
+
+	TP_printk("pid=%d duration_ns=%llu ret=%ld", __entry->pid, __entry->duration_ns, __entry->ret)
+);
+
+// kernel_clone() in the launching kthread, ret is the child's pid
+DEFINE_EVENT(program2_phase, program2_clone,
+	TP_PROTO(pid_t pid, u64 duration_ns, long ret),
+	TP_ARGS(pid, duration_ns, ret));
+
+// getname_kernel() in the child
+DEFINE_EVENT(program2_phase, program2_getname,
+	TP_PROTO(pid_t pid, u64 duration_ns, long ret),
+	TP_ARGS(pid, duration_ns, ret));
+
+// kernel_execve() in the child, loading the program up to its first instruction
+DEFINE_EVENT(program2_phase, program2_execve,
+	TP_PROTO(pid_t pid, u64 duration_ns, long ret),
+	TP_ARGS(pid, duration_ns, ret));
+
+// kernel_wait() in the launching kthread, ret is the wait status
+DEFINE_EVENT(program2_phase, program2_wait,
+	TP_PROTO(pid_t pid, u64 duration_ns, long ret),
+	TP_ARGS(pid, duration_ns, ret));
+
+#endif /* _PROGRAM2_TRACE_H */
+
+// the module is built out of tree, look for this header next to program2.c
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE program2_trace
+#include <trace/define_trace.h>